@@ -1,156 +1,103 @@
 /*
 This sketch runs infinitely and does the following steps:
-1) checks if the flash memory of Agrumino is "dirty" (this mean we need to push
-   some data).
-2a) if the memory is dirty and the specified number of hours haven't passed 
-    then the sensors data are collected and stored in flash
-2b) if the specified amount of hours is matched then the data are retrieved
-    from the flash memory and the memory is cleaned
+1) collects the sensors data and stages it in the RTC memory, that survives
+   the deep sleep: the staged samples are moved, compressed, to the flash
+   memory of Agrumino only when the RTC memory is full or before a push, so
+   most wake-ups don't write the flash at all
+2) asks the flush policy (see AgruminoFlushPolicy.h) if the buffered data
+   should be pushed now: when the memory is almost full, on USB power, after
+   too many hours or when the readings changed enough
+3) if so the data are retrieved from the flash memory and the memory is cleaned
 
 */
 
 #include <Agrumino.h>
+#include <AgruminoFlushPolicy.h>
 Agrumino agrumino;
+AgruminoFlushPolicy flushPolicy;
 
-int hours = 4; //change this to change the frequency of the data pushing
 int sleepTime = 10; //time for deepsleep in seconds: change to rest more or less
 
-//temp variable to store the addresses
-int attUSBADD;
-int chargADD;
-int buttonADD;
-int tempADD;
-int soilADD;
-int illADD;
-int voltADD;
-int battLVLADD;
-
-//tells us if the memory is dirty
-boolean wrote=false;
-
 void setup() 
 {
   //initializing and powering the board, then enabling the memory
   Serial.begin(115200);
   agrumino.setup();
+  //the soil readings are smoothed across the wake-ups (the filter state is kept in the RTC memory)
+  agrumino.setSoilFilterPersistent(true);
   agrumino.turnBoardOn();
   agrumino.enableMemory();
-  
-  //checking if the memory is "dirty" (A.K.A if there's some data to push)
-  if(agrumino.getDirty()==0)
-    wrote=false; //not dirty
-  else
-     wrote=true; //dirty
+  agrumino.enableStaging(true);
 
+  //pushing the data at least every 4 hours (24 with low battery), after 1 hour if the readings changed
+  flushPolicy.setHours(1, 4);
 }
 
 void loop() 
 {   
-  if(wrote && agrumino.getHours()>=hours) //checking if enough time has been passed since the last upload
+  //collecting sensors data
+  Serial.println("\nREADING DATA...");
+  //all the sensors are read together: the wait is the one of the slowest sensor
+  AgruminoSample sample;
+  agrumino.sampleAll(sample);
+
+  Serial.println("\nSTAGING DATA IN RTC MEMORY...");
+
+  //staging the sample and increasing the hours counter: the flash is written
+  //(in a single commit) only when the staging buffer is full
+  boolean stored = agrumino.stageSample(sample);
+  agrumino.incrHours();
+
+  //printing the values staged, to check their legality
+  AgruminoSample check;
+  if(stored && agrumino.readStaged(agrumino.getStagedCount()-1, check))
   {
-      int h = 0; //used to iterate
-      while(h<agrumino.getHours())
-      {
-          //Reading all the datas from the flash
-          Serial.println("("+String(h)+")");
-          //getting the address of every sensor data, based on the offset of its data type
-          attUSBADD = agrumino.getStartAddress();
-          chargADD = attUSBADD+1 ;
-          buttonADD = chargADD+1;
-          tempADD = buttonADD+1;
-          soilADD = tempADD+4;
-          illADD = soilADD+4;
-          voltADD = illADD+4;
-          battLVLADD = voltADD+4;
+      Serial.println("\nJUST STAGED: ");
+      printSample(check);
+  }
+
+  //flash wear since the memory was first used
+  EEPROMStats stats = agrumino.getFlashStats();
+  Serial.println("flash erases: "+String(stats.erases)+", bytes written: "+String(stats.bytesWritten)+", time in flash (us): "+String(stats.flashMicros));
+
+  //asking the policy if it's time to push, the first buffered sample (in flash or still staged) tells how much
+  //the readings changed. The staged samples will take up to AGRUMINO_CODEC_MAX_SIZE bytes each in the flash
+  AgruminoSample first;
+  boolean buffered = agrumino.readCompressed(0, first) || agrumino.readStaged(0, first);
+  int freeMemory = agrumino.getFreeMemory()-agrumino.getStagedCount()*AGRUMINO_CODEC_MAX_SIZE;
+  uint8_t reasons = flushPolicy.decide(sample, buffered ? &first : NULL, freeMemory, agrumino.getHours());
+  if(!stored)
+      reasons |= AGRUMINO_FLUSH_FULL; //never reached with a sensible reserve, but the sample mustn't be lost
+  if(reasons)
+  {
+      Serial.println("\nPUSHING DATA: "+String(AgruminoFlushPolicy::reasonName(reasons)));
 
+      //moving the staged samples to the flash, so they are pushed with the others
+      agrumino.flushStaging();
+
+      //samples are stored compressed (see AgruminoCodec.h) and must be read in order
+      int count = agrumino.getCompressedCount();
+      for(int h=0; h<count; h++)
+      {
+          AgruminoSample buffered;
+          if(!agrumino.readCompressed(h, buffered))
+              continue;
 
           //printing the values obtained from the memory
+          Serial.println("("+String(h)+")");
           Serial.println("\nREAD FROM FLASH: ");
-          Serial.println("isAttachedToUSB:   " + String(agrumino.boolRead(attUSBADD)));
-          Serial.println("isBatteryCharging: " + String(agrumino.boolRead(chargADD)));
-          Serial.println("isButtonPressed: "+String(agrumino.boolRead(buttonADD)));
-          Serial.println("temperature:       " + String(agrumino.floatRead(tempADD)));
-          Serial.println("soilMoisture:      " + String(agrumino.floatRead(soilADD)));
-          Serial.println("illuminance :      " + String(agrumino.floatRead(illADD)));
-          Serial.println("batteryVoltage :   " + String(agrumino.floatRead(voltADD)));
-          Serial.println("batteryLVL: "+String(agrumino.intRead(battLVLADD)));
-          Serial.println("");
-
-          agrumino.setStartAddress(battLVLADD+1); //updating the starting point for the next read
-          h++;
+          printSample(buffered);
       }
 
-      //cleaning the memory at the end
-      boolean init = agrumino.initializeMemory();
+      //dropping the pushed data: the memory is not rewritten, its space is reclaimed when needed
+      boolean init = agrumino.discardMemory();
       if(!init)
       {
         Serial.println("Final memory clean failed: aborting");
         return;
-      }      
-  }
-  else
-  {
-      //collecting sensors data
-      Serial.println("\nREADING DATA...");
-      boolean isAttachedToUSB =   agrumino.isAttachedToUSB();
-      boolean isBatteryCharging = agrumino.isBatteryCharging();
-      boolean isButtonPressed =   agrumino.isButtonPressed();
-      float temperature =         agrumino.readTempC();
-      float soilMoisture = agrumino.readSoilRaw();
-      float illuminance =         agrumino.readLux();
-      float batteryVoltage =      agrumino.readBatteryVoltage();
-      unsigned int batteryLevel = agrumino.readBatteryLevel();
-    
-      
-      Serial.println("\nSTORING DATA IN FLASH...");
-
-      //reading the different data, and storing them into the flash memory. Also backupping the registers of every data
-      attUSBADD = agrumino.getLastAvaiableAddress();
-      agrumino.boolWrite(isAttachedToUSB);
-      Serial.println("wrote attacchedUSB (bool) in REG_"+String(attUSBADD));
-
-      chargADD = agrumino.getLastAvaiableAddress();
-      agrumino.boolWrite(isBatteryCharging);
-      Serial.println("wrote chargBatt (bool) in REG_"+String(chargADD));
-
-      buttonADD = agrumino.getLastAvaiableAddress();
-      agrumino.boolWrite(isButtonPressed);
-      Serial.println("wrote button status (bool) in REG_"+String(buttonADD));
-      
-      tempADD = agrumino.getLastAvaiableAddress();
-      agrumino.floatWrite(temperature);
-      Serial.println("wrote the temperature (float) in REG_"+String(tempADD));
-      
-      soilADD = agrumino.getLastAvaiableAddress();
-      agrumino.floatWrite(soilMoisture);
-      Serial.println("wrote the soil (int) in REG_"+String(soilADD));
-
-      illADD = agrumino.getLastAvaiableAddress();
-      agrumino.floatWrite(illuminance);
-      Serial.println("wrote the ill. (float) in REG_"+String(illADD));
-
-      voltADD = agrumino.getLastAvaiableAddress();
-      agrumino.floatWrite(batteryVoltage);
-      Serial.println("wrote the battery Voltage (float) in REG_"+String(voltADD));
-            
-      battLVLADD = agrumino.getLastAvaiableAddress();
-      agrumino.intWrite(batteryLevel);
-      Serial.println("wrote the battery level (int) in REG_"+String(battLVLADD));
-
-      //increasing the hours counter
-      agrumino.incrHours();
-            
-      //printing the values obtained from the sensors, and confronting them with the value stored in memory, to check its legality
-      Serial.println("\nJUST STORED IN MEMORY: ");
-      Serial.println("isAttachedToUSB:   " + String(agrumino.boolRead(attUSBADD)));
-      Serial.println("isBatteryCharging: " + String(agrumino.boolRead(chargADD)));
-      Serial.println("isButtonPressed: "+String(agrumino.boolRead(buttonADD)));
-      Serial.println("temperature:       " + String(agrumino.floatRead(tempADD)));
-      Serial.println("soilMoisture:      " + String(agrumino.floatRead(soilADD)));
-      Serial.println("illuminance :      " + String(agrumino.floatRead(illADD)));
-      Serial.println("batteryVoltage :   " + String(agrumino.floatRead(voltADD)));
-      Serial.println("batteryLevel: "+String(agrumino.intRead(battLVLADD)));
-      Serial.println("");
+      }
+      if(!stored)
+        agrumino.stageSample(sample);
   }
 
   Serial.println("Sleeping...");
@@ -163,6 +110,19 @@ void loop()
 // Utility methods //
 /////////////////////
 
+void printSample(const AgruminoSample &sample) {
+  Serial.println("isAttachedToUSB:   " + String(sample.isAttachedToUSB));
+  Serial.println("isBatteryCharging: " + String(sample.isBatteryCharging));
+  Serial.println("isButtonPressed:   " + String(sample.isButtonPressed));
+  Serial.println("temperature:       " + String(sample.temperature));
+  Serial.println("soilMoisture:      " + String(sample.soilMoisture));
+  Serial.println("illuminance :      " + String(sample.illuminance));
+  Serial.println("batteryVoltage :   " + String(sample.batteryVoltage));
+  Serial.println("batteryLevel:      " + String(sample.batteryLevel));
+  Serial.println("time:              " + String(sample.time));
+  Serial.println("");
+}
+
 void blinkLed() {
   agrumino.turnLedOn();
   delay(200);
@@ -173,6 +133,7 @@ void delaySec(int sec) {
   delay (sec * 1000);
 }
 
+//through the library, so the clock of the samples counts the sleep (see AgruminoClock.h)
 void deepSleepSec(int sec) {
-  ESP.deepSleep(sec * 1000000); // microseconds
+  agrumino.deepSleepSec(sec);
 }
@@ -7,10 +7,17 @@
 */
 
 #include "Agrumino.h"
+#include "AgruminoWiFi.h"
 #include <Wire.h>
+
+extern "C" {
+#include "user_interface.h"
+}
+#include "libraries/I2CBus/I2CBus.cpp" // Timeouts, retries and error counters of every I2C transaction below
 #include "libraries/MCP9800/MCP9800.cpp"
 #include "libraries/PCA9536_FIX/PCA9536_FIX.cpp" // PCA9536.h lib has been modified (REG_CONFIG renamed to REG_CONFIG_PCA) to avoid name clashing with mcp9800.h
 #include "libraries/MCP3221/MCP3221.cpp"
+#include "libraries/ISL29003/ISL29003.cpp"
 
 
 // PINOUT Agrumino        Implemented
@@ -30,14 +37,14 @@
 #define I2C_ADDR_GPIO_EXP  0x41 // [-] BOTTOM LED OK, TODO: GPIO 2-3-4 
 
 //Addresses for flash utility
-#define DIRTY 0 //tells the user if the memory is "dirty" A.K.A if there's some data that need to be pushed. Must be manually handled by the user
-#define LASTFREEADD 1 //address that tells the user the last free index (reliable only if writing sequentially)
-#define FREE_MEMORY 5 //address containing how many Bites of memory are free
-#define START_ADDRESS 10 //starting address to read the datas (for RST survive)
-#define HOURS 14 //register for keeping the amount of hours since last data push
-#define USERSPACE 20 //the index from which the user can start writing data
+#define HEADER 0 //journal of the registers (AgruminoMemoryHeader) and of the flash counters, see EEPROMClass::setJournal()
+#define HEADER_SLOTS 8 //every commit saves the registers in the next free slot, the sector is erased at least every HEADER_SLOTS commits
+#define USERSPACE ((int) (HEADER+HEADER_SLOTS*EEPROM_JOURNAL_SLOT_SIZE(sizeof(AgruminoMemoryHeader)))) //the index from which the user can start writing data (384)
 #define MAX_MEMORY 4096 //fixed max flash size
 
+// RTC user memory (4 bytes blocks, the first 32 are left to the OTA boot loader)
+#define RTC_WAKE_BLOCK  32 // AgruminoWakeState, the WiFi cache (AgruminoWiFi.h), the clock (AgruminoClock.h) and the staging buffer (AgruminoStaging.h) follow it
+
 ////////////
 // CONFIG //
 ////////////
@@ -55,6 +62,21 @@
 #define BATTERY_VOLT_DIVIDER_Z1      1800 // Value of the Z1(R25) resistor in the Voltage divider used for read the batt voltage.
 #define BATTERY_VOLT_DIVIDER_Z2       424 // 470 (Original) // Value of the Z2(R26) resistor. Adjusted considering the ADC internal resistance.
 #define BATTERY_VOLT_SAMPLES           20 // Number of reading needed to calculate the battery voltage
+#define BATTERY_MICROVOLT_PER_COUNT  ((BATTERY_VOLT_DIVIDER_Z1 + BATTERY_VOLT_DIVIDER_Z2) * 1000000UL / (BATTERY_VOLT_DIVIDER_Z2 * 1024UL)) // Battery voltage of an ADC step (10 bit, 0-1V)
+#define BATTERY_ADC_CLOCK_DIV           8 // system_adc_read_fast() clock divider (8-32)
+// Temperature sensor
+#define TEMP_RESOLUTION    MCP_ADC_RES_10 // 10bit (0.25c, below the ±0.5c accuracy), one shot conversion in 60ms: 11bit would double it
+// Light sensor
+#define LUX_PRECISION_PERCENT         1.0 // The ISL29003 picks the fastest conversion that gives it: 12 bit (5.6ms) in the shade
+#define LUX_PRECISION_LUX             1.0 // ...or a step this small, in the dark
+// Sensors readiness after the board power up (see waitSensor())
+#define SOIL_READY_MS                  35 // First reading of the MCP3221 after ~30ms
+// Sensors found by initBoard()
+#define SENSOR_LUX                   0x01
+#define SENSOR_SOIL                  0x02
+#define SENSOR_TEMP                  0x04
+#define SENSOR_GPIO_EXP              0x08
+#define WAKE_STATE_VERSION              1 // Change with the sensors configuration, to force a full init on the next wake-up
 
 ///////////////
 // Variables //
@@ -63,17 +85,56 @@
 MCP9800 mcpTempSensor;
 PCA9536 pcaGpioExpander;
 MCP3221 mcpSoilSensor(I2C_ADDR_SOIL);
+ISL29003 islLuxSensor(I2C_ADDR_LUX);
 unsigned int _soilRawAir;
 unsigned int _soilRawWater;
 
+// Kept in the RTC user memory across the deep sleep, written by every full init (see fastInitBoard())
+struct AgruminoWakeState {
+  uint32_t crc;        // CRC-32 of the sensors configuration and of sensors: a power loss or a new configuration fail the check
+  uint8_t sensors;     // SENSOR_* that answered to the last full init
+  uint8_t reserved;
+  uint16_t soilFilter; // State of the soil smoothing filter, FILTER_EMPTY = empty (see setSoilFilterPersistent())
+};
+
+static_assert(RTC_WAKE_BLOCK + sizeof(AgruminoWakeState) / 4 <= AGRUMINO_WIFI_RTC_BLOCK, "The wake state overlaps the WiFi cache");
+
+static uint32_t wakeStateCrc(uint8_t sensors) {
+  static const uint8_t config[] = {
+    WAKE_STATE_VERSION,
+    I2C_ADDR_LUX,
+    I2C_ADDR_SOIL,
+    I2C_ADDR_TEMP, TEMP_RESOLUTION,
+    I2C_ADDR_GPIO_EXP, IO_PCA9536_LED
+  };
+  return EEPROMClass::crc32(&sensors, 1, EEPROMClass::crc32(config, sizeof(config)));
+}
+
 /////////////////
 // Constructor //
 /////////////////
 
 Agrumino::Agrumino() {
+  _batch = false;
+  _log = false;
+  memset(&_memory, 0, sizeof(_memory));
+  _writerStart = -1;
+  _writerEnd = -1;
+  _compressedCount = 0;
+  _readerAddress = -1;
+  _readerIndex = -1;
+  _staged = false;
+  _stagingCompressed = false;
+  _spilled = 0;
+  _spilledHours = 0;
+  _boardOnMillis = 0;
+  _pendingSensors = 0;
+  _batteryMilliVolt = 0;
+  _soilFilterPersistent = false;
 }
 
 void Agrumino::setup() {
+  _clock.begin();
   setupGpioModes();
   printLogo();
   // turnBoardOn(); // Decomment to have the board On by Default
@@ -89,7 +150,21 @@ void Agrumino::deepSleepSec(unsigned int sec) {
   Serial.print("\nGoing to deepSleep for ");
   Serial.print(sec);
   Serial.println(" seconds... (ー。ー) zzz\n");
-  ESP.deepSleep(sec * 1000000); // microseconds
+  _clock.sleep(sec * 1000UL);
+  ESP.deepSleep(sec * 1000000ULL); // microseconds
+}
+
+uint32_t Agrumino::getTime() {
+  return _clock.now();
+}
+
+// unixTime is the time now, e.g. the Date of the reply of the upload. Returns false if it can't be right
+bool Agrumino::setTime(uint32_t unixTime) {
+  return _clock.setTime(unixTime);
+}
+
+uint32_t Agrumino::getEpoch() {
+  return _clock.getEpoch();
 }
 
 /////////////////////////
@@ -115,14 +190,21 @@ boolean Agrumino::isBoardOn() {
 void Agrumino::turnBoardOn() {
   if (!isBoardOn()) {
     digitalWrite(PIN_MOSFET, HIGH);
+    _boardOnMillis = millis();
+    _batteryMilliVolt = 0;
     delay(5); // Ensure that the ICs are booted up properly
-    initBoard();
+    if (!fastInitBoard()) {
+      initBoard();
+    }
     checkBattery();
   }
 }
 
 void Agrumino::turnBoardOff() {
   digitalWrite(PIN_MOSFET, LOW);
+  pcaGpioExpander.invalidate(); // The expander loses its registers
+  islLuxSensor.invalidate();
+  _batteryMilliVolt = 0;
 }
 
 void Agrumino::turnWateringOn() {
@@ -137,6 +219,7 @@ void Agrumino::turnWateringOff() {
 // Public methods I2C //
 ////////////////////////
 
+// Every reading is a new one shot conversion, or the one in progress (see configureTempSensor())
 float Agrumino::readTempC() {
   return mcpTempSensor.readCelsiusf();
 }
@@ -161,6 +244,16 @@ void Agrumino::toggleLed() {
   pcaGpioExpander.toggleState(IO_PCA9536_LED);
 }
 
+// Transactions, retries and failures of the sensor at address (see I2CBus.h)
+I2CDeviceStats Agrumino::getI2CStats(uint8_t address) {
+  return i2cBus.stats(address);
+}
+
+// Transactions of all the sensors failed after the retries, since the power up
+uint32_t Agrumino::getI2CFailures() {
+  return i2cBus.failures();
+}
+
 void Agrumino::calibrateSoilWater() {
   _soilRawWater = readSoilRaw();
 }
@@ -184,39 +277,75 @@ unsigned int Agrumino::readSoil() {
 }
 
 float Agrumino::readLux() {
-  // Logic for Light-to-Digital Output Sensor ISL29003
-  Wire.beginTransmission(I2C_ADDR_LUX);
-  Wire.write(0x02); // Data registers are 0x02->LSB and 0x03->MSB
-  Wire.endTransmission();
-  Wire.requestFrom(I2C_ADDR_LUX, 2); // Request 2 bytes of data
-  unsigned int data;
-  if (Wire.available() == 2) {
-    byte lsb = Wire.read();
-    byte  msb = Wire.read();
-    data = (msb << 8) | lsb;
-  } else {
-    Serial.println("readLux Error!");
-    return 0;
+  float lux;
+  while (!pollLux(lux)) {
+    islLuxSensor.waitConversion();
   }
-  // Convert the data from the ADC to lux
-  // 0-64000 is the selected range of the ALS (Lux)
-  // 0-65536 is the selected range of the ADC (16 bit)
-  return (64000.0 * (float) data) / 65536.0;
+  return lux;
 }
 
 float Agrumino::readBatteryVoltage() {
-  float voltSum = 0.0;
-  for (int i = 0; i < BATTERY_VOLT_SAMPLES; ++i) {
-    voltSum += readBatteryVoltageSingleShot();
-  }
-  float volt = voltSum / BATTERY_VOLT_SAMPLES;
-  // Serial.println("readBatteryVoltage: " + String(volt) + " V");
-  return volt;
+  return readBatteryMilliVolt() * 0.001f;
 }
 
 unsigned int Agrumino::readBatteryLevel() {
-  float voltage = readBatteryVoltage();
-  unsigned int milliVolt = (int) (voltage * 1000.0);
+  return batteryLevel(readBatteryMilliVolt());
+}
+
+// The battery readings share a single measurement, taken by turnBoardOn()
+// (or by the first reading with the board off) and kept until the board is
+// turned off or refreshBattery() is called
+unsigned int Agrumino::readBatteryMilliVolt() {
+  if (!_batteryMilliVolt) {
+    _batteryMilliVolt = measureBattery();
+  }
+  return _batteryMilliVolt;
+}
+
+void Agrumino::refreshBattery() {
+  _batteryMilliVolt = measureBattery();
+}
+
+// Reads all the sensors and the GPIOs into sample, the conversions overlapping:
+// the battery is read while the sensors get ready after the power up, then
+// every sensor is read as soon as its first reading is ready. The time is the
+// one of the slowest sensor instead of the sum of all of them.
+// Returns false if the board is off
+boolean Agrumino::sampleAll(AgruminoSample &sample) {
+  if (!isBoardOn()) {
+    return false;
+  }
+  sample.time = getTime();
+  sample.isAttachedToUSB = isAttachedToUSB();
+  sample.isBatteryCharging = isBatteryCharging();
+  sample.isButtonPressed = isButtonPressed();
+  sample.batteryVoltage = readBatteryVoltage();
+  sample.batteryLevel = readBatteryLevel();
+
+  uint8_t todo = SENSOR_LUX | SENSOR_SOIL | SENSOR_TEMP;
+  float lux;
+  while (todo) {
+    uint8_t before = todo;
+    if ((todo & SENSOR_SOIL) && sensorReady(SENSOR_SOIL, SOIL_READY_MS)) {
+      sample.soilMoisture = readSoilRaw();
+      todo &= ~SENSOR_SOIL;
+    }
+    if ((todo & SENSOR_TEMP) && mcpTempSensor.isConversionReady()) {
+      sample.temperature = readTempC();
+      todo &= ~SENSOR_TEMP;
+    }
+    if ((todo & SENSOR_LUX) && pollLux(lux)) {
+      sample.illuminance = lux;
+      todo &= ~SENSOR_LUX;
+    }
+    if (todo == before) {
+      delay(1);
+    }
+  }
+  return true;
+}
+
+unsigned int Agrumino::batteryLevel(unsigned int milliVolt) {
   milliVolt = constrain(milliVolt, BATTERY_MILLIVOLT_LEVEL_0, BATTERY_MILLIVOLT_LEVEL_100);
   return map(milliVolt, BATTERY_MILLIVOLT_LEVEL_0, BATTERY_MILLIVOLT_LEVEL_100, 0, 100);
 }
@@ -225,76 +354,159 @@ unsigned int Agrumino::readBatteryLevel() {
 // Private methods //
 /////////////////////
 
-void Agrumino::initGpioExpander() {
+boolean Agrumino::initGpioExpander() {
   Serial.print("initGpioExpander → ");
   byte result = pcaGpioExpander.ping();;
   if (result == 0) {
     pcaGpioExpander.reset();
-    pcaGpioExpander.setMode(IO_PCA9536_LED, IO_OUTPUT); // Back green LED
-    pcaGpioExpander.setState(IO_PCA9536_LED, IO_LOW);
+    configureGpioExpander();
     Serial.println("OK");
+    return true;
   } else {
     Serial.println("FAIL!");
+    return false;
   }
 }
 
-void Agrumino::initTempSensor() {
+boolean Agrumino::initTempSensor() {
   Serial.print("initTempSensor   → ");
   boolean success = mcpTempSensor.init(true);
   if (success) {
-    mcpTempSensor.setResolution(MCP_ADC_RES_11); // 11bit (0.125c)
-    mcpTempSensor.setOneShot(true);
+    configureTempSensor();
     Serial.println("OK");
   } else {
     Serial.println("FAIL!");
   }
+  return success;
 }
 
-void Agrumino::initSoilSensor() {
+boolean Agrumino::initSoilSensor() {
   Serial.print("initSoilSensor   → ");
   byte response = mcpSoilSensor.ping();;
   if (response == 0) {
-    mcpSoilSensor.reset();
-    mcpSoilSensor.setSmoothing(EMAVG);
-    // mcpSoilSensor.setVref(3300); This will make the reading of the MCP3221 voltage accurate. Currently is not needed because we need just a range
-    _soilRawAir = DEFAULT_SOIL_RAW_AIR;
-    _soilRawWater = DEFAULT_SOIL_RAW_WATER;
+    configureSoilSensor();
     Serial.println("OK");
+    return true;
   } else {
     Serial.println("FAIL!");
+    return false;
   }
 }
 
-void Agrumino::initLuxSensor() {
+boolean Agrumino::initLuxSensor() {
   // Logic for Light-to-Digital Output Sensor ISL29003
   Serial.print("initLuxSensor    → ");
-  Wire.beginTransmission(I2C_ADDR_LUX);
-  byte result = Wire.endTransmission();
+  byte result = i2cBus.ping(I2C_ADDR_LUX);
   if (result == 0) {
-    Wire.beginTransmission(I2C_ADDR_LUX);
-    Wire.write(0x00); // Select "Command-I" register
-    Wire.write(0xA0); // Select "ALS continuously" mode
-    Wire.endTransmission();
-    Wire.beginTransmission(I2C_ADDR_LUX);
-    Wire.write(0x01); // Select "Command-II" register
-    Wire.write(0x03); // Set range = 64000 lux, ADC 16 bit
-    Wire.endTransmission();
+    configureLuxSensor();
     Serial.println("OK");
+    return true;
   } else {
     Serial.println("FAIL!");
+    return false;
   }
 }
 
+// The configure methods write the settings of a sensor that is known to be
+// there and just powered up (all its registers at the default values)
+
+boolean Agrumino::configureGpioExpander() {
+  pcaGpioExpander.powerUp(); // Registers at the defaults, no need to read them back
+  pcaGpioExpander.setState(IO_PCA9536_LED, IO_LOW); // Before the mode, the output register is high at power up
+  pcaGpioExpander.setMode(IO_PCA9536_LED, IO_OUTPUT); // Back green LED
+  return pcaGpioExpander.getComResult() == 0;
+}
+
+// Also starts the first conversion, that goes on while the rest of the board
+// is initialized and read
+void Agrumino::configureTempSensor() {
+  mcpTempSensor.powerUp(); // Config register at the default, no need to read it back
+  mcpTempSensor.setResolution(TEMP_RESOLUTION);
+  mcpTempSensor.setOneShot(true);
+  mcpTempSensor.startConversion();
+}
+
+void Agrumino::configureSoilSensor() {
+  mcpSoilSensor.reset();
+  mcpSoilSensor.setSmoothing(EMAVG);
+  // mcpSoilSensor.setVref(3300); This will make the reading of the MCP3221 voltage accurate. Currently is not needed because we need just a range
+  _soilRawAir = DEFAULT_SOIL_RAW_AIR;
+  _soilRawWater = DEFAULT_SOIL_RAW_WATER;
+}
+
+// Also starts the first measurement, that goes on while the rest of the
+// board is initialized and read
+boolean Agrumino::configureLuxSensor() {
+  islLuxSensor.powerUp(); // Registers at the defaults, powered down
+  islLuxSensor.setAutoRange(true);
+  islLuxSensor.setPrecision(LUX_PRECISION_PERCENT, LUX_PRECISION_LUX);
+  return islLuxSensor.start();
+}
+
+// Carries on the light measurement into lux, starting one if none is in
+// progress. Returns false until it is over: the sensor is read only at the
+// end of a conversion (see ISL29003.h)
+boolean Agrumino::pollLux(float &lux) {
+  if (!islLuxSensor.isBusy()) {
+    islLuxSensor.start();
+  }
+  if (!islLuxSensor.poll()) {
+    return false;
+  }
+  if (islLuxSensor.getError() != I2C_BUS_OK) {
+    Serial.println("readLux Error!");
+  }
+  lux = islLuxSensor.getLux();
+  return true;
+}
+
+// True if the first reading of a sensor is ready, readyMillis after the board power up
+boolean Agrumino::sensorReady(uint8_t sensor, unsigned long readyMillis) {
+  return !(_pendingSensors & sensor) || millis() - _boardOnMillis >= readyMillis;
+}
+
+// Waits for the first reading of a sensor to be ready
+void Agrumino::waitSensor(uint8_t sensor, unsigned long readyMillis) {
+  while (!sensorReady(sensor, readyMillis)) {
+    delay(1);
+  }
+  _pendingSensors &= ~sensor;
+}
+
 unsigned int Agrumino::readSoilRaw() {
-  return mcpSoilSensor.getVoltage();
+  waitSensor(SENSOR_SOIL, SOIL_READY_MS);
+  unsigned int soilRaw = mcpSoilSensor.getVoltage();
+  if (_soilFilterPersistent) {
+    saveSoilFilter();
+  }
+  return soilRaw;
 }
 
-float Agrumino::readBatteryVoltageSingleShot() {
-  float z1 = (float) BATTERY_VOLT_DIVIDER_Z1;
-  float z2 = (float) BATTERY_VOLT_DIVIDER_Z2;
-  float vread = (float) analogRead(A0) / 1024.0; // RAW Value from the ADC, Range 0-1V
-  float volt = ((z1 + z2) / z2) * vread;
-  return volt;
+// The soil readings are smoothed (EMAVG) by the MCP3221 driver, but its filter
+// starts again from the first reading of every wake-up: with a reading per
+// wake-up there is no smoothing at all. Persistent, the filter state goes to
+// the RTC memory with the wake state and is restored by fastInitBoard()
+void Agrumino::setSoilFilterPersistent(boolean persistent) {
+  _soilFilterPersistent = persistent;
+}
+
+// Battery voltage in mV, the mean of BATTERY_VOLT_SAMPLES ADC readings summed
+// as integers. With the radio off the readings are a single burst of
+// system_adc_read_fast(), else they go through analogRead() one by one
+unsigned int Agrumino::measureBattery() {
+  uint16_t readings[BATTERY_VOLT_SAMPLES];
+  if (wifi_get_opmode() == NULL_MODE) {
+    system_adc_read_fast(readings, BATTERY_VOLT_SAMPLES, BATTERY_ADC_CLOCK_DIV);
+  } else {
+    for (int i = 0; i < BATTERY_VOLT_SAMPLES; ++i) {
+      readings[i] = analogRead(A0);
+    }
+  }
+  uint32_t sum = 0;
+  for (int i = 0; i < BATTERY_VOLT_SAMPLES; ++i) {
+    sum += readings[i];
+  }
+  return (sum * BATTERY_MICROVOLT_PER_COUNT + BATTERY_VOLT_SAMPLES * 500UL) / (BATTERY_VOLT_SAMPLES * 1000UL);
 }
 
 // Return true if the battery is ok
@@ -310,45 +522,116 @@ boolean Agrumino::checkBattery() {
 }
 
 /*initializes the Agrumino memory by putting (255) all over it's flash, then
- * sets the reserved addresses. Returns false if the
-   board isn't active*/
+ * sets the registers. The whole memory is prepared in RAM and written
+ * with a single erase. Returns false if the board isn't active*/
 bool Agrumino::initializeMemory()
 {
     if(isBoardOn())
     {
-        EEPROM.begin(MAX_MEMORY);
-
-        //writing 255 on all the address, excluding the reserved ones
-        for(int i=0; i<MAX_MEMORY; i++)
-        {
-            EEPROM.write(i,255);
-            EEPROM.commit();
-        }
-        EEPROM.put(LASTFREEADD,USERSPACE); //setting the first address in which the user can write
-        EEPROM.commit();
-        int m = MAX_MEMORY-20;
-        EEPROM.put(FREE_MEMORY,m); //setting the free memory
-        EEPROM.commit();
-        EEPROM.put(START_ADDRESS,USERSPACE); //setting the start address as the first user address, since the memory is empty
-        EEPROM.commit();
-        RSTHours(); //setting the hours without push as 0
-        setDirty(false); //flagging the memory as "clean"
-        return true;
+        enableMemory();
+        uint16_t generation = _memory.generation+1;
+
+        //writing 255 on all the user addresses (the journal is handled by the EEPROM library, the flash counters survive the initialization)
+        memset(EEPROM.getDataPtr()+USERSPACE,255,MAX_MEMORY-USERSPACE);
+
+        _memory.lastFree = USERSPACE; //setting the first address in which the user can write
+        int m = MAX_MEMORY-USERSPACE;
+        _memory.freeMemory = m; //setting the free memory
+        _memory.start = USERSPACE; //setting the start address as the first user address, since the memory is empty
+        _memory.hours = 0; //setting the hours without push as 0
+        _memory.dirty = false; //flagging the memory as "clean"
+        _memory.generation = generation;
+        dropSpilled();
+        return commitMemory();
     }
     else
         return false;
 }
 
-//useful to use the memory without re-initializing it (i.e.: after a RST)
+/*drops all the data without rewriting the memory: START_ADDRESS is moved to
+  LASTFREEADD, so the old data is skipped by the readers, and its space is reclaimed
+  only when the memory gets full (see compactMemory()). Resets the hours and the dirty
+  flag too. Much cheaper than initializeMemory() after every data push*/
+bool Agrumino::discardMemory()
+{
+    int lastAvaiableAddress = getLastAvaiableAddress();
+    if(lastAvaiableAddress<USERSPACE || lastAvaiableAddress>MAX_MEMORY) //registers corrupted
+        return initializeMemory();
+
+    _memory.start = lastAvaiableAddress;
+    int m = MAX_MEMORY-USERSPACE;
+    _memory.freeMemory = m;
+    _memory.hours = 0;
+    _memory.dirty = false;
+    _memory.generation++;
+    dropSpilled();
+    return commitMemory();
+}
+
+//returns how many times the data has been initialized or discarded (wraps around at 65536)
+unsigned int Agrumino::getGeneration()
+{
+    return _memory.generation;
+}
+
+/*useful to use the memory without re-initializing it (i.e.: after a RST).
+  The registers are restored from the newest valid copy in the journal: since all of
+  them are saved together, with a CRC, in a single commit, a reset in the middle of a
+  write can't leave them inconsistent. If no valid copy is found (the memory has never
+  been initialized) the registers are reset to an empty memory and false is returned*/
 bool Agrumino::enableMemory()
 {
+    EEPROM.setJournal(HEADER,HEADER_SLOTS,&_memory,sizeof(_memory));
     EEPROM.begin(MAX_MEMORY);
+    _batch = false;
+    if(EEPROM.journalValid())
+        return true;
+
+    _memory.lastFree = USERSPACE;
+    _memory.freeMemory = MAX_MEMORY-USERSPACE;
+    _memory.start = USERSPACE;
+    _memory.hours = 0;
+    _memory.generation = 0;
+    _memory.dirty = false;
+    _memory.reserved = 0;
+    return false;
+}
+
+/*starts a batch of writes: until commitBatch() is called every write (values and
+  reserved registers) only changes the RAM copy of the flash. This way a whole
+  sample costs a single sector erase instead of one (or more) for each value*/
+void Agrumino::beginBatch()
+{
+    _batch = true;
+}
+
+//ends the batch started by beginBatch(), writing everything to the flash at once
+bool Agrumino::commitBatch()
+{
+    _batch = false;
+    return EEPROM.commit();
+}
+
+//commits the RAM copy to the flash, unless a batch is in progress
+bool Agrumino::commitMemory()
+{
+    if(_batch)
+        return true;
+    return EEPROM.commit();
+}
+
+/*returns the flash operations done since the memory was first initialized: commits,
+  sector erases, bytes written, commits skipped because nothing changed and the time
+  spent erasing and writing (in microseconds). A sector is rated for about 100000 erases*/
+EEPROMStats Agrumino::getFlashStats()
+{
+    return EEPROM.stats();
 }
 
 //returns a boolean depending on the presence on datas on the flash
 bool Agrumino::getDirty()
 {
-    return (bool) EEPROM.read(DIRTY);
+    return _memory.dirty;
 }
 
 /*Sets the dirty address of the flash storage to either 1 or 0.
@@ -356,19 +639,17 @@ bool Agrumino::getDirty()
   or not.*/
 void Agrumino::setDirty(bool isDirty)
 {
-    EEPROM.put(DIRTY,isDirty);
-    EEPROM.commit();
+    _memory.dirty = isDirty;
+    commitMemory();
 }
 
 //returns the free memory amount
 int Agrumino::getFreeMemory()
 {
-    int result = 0;
-    EEPROM.get(FREE_MEMORY,result);
-    return (int) result;
+    return _memory.freeMemory;
 }
 
-//returns the maximum memory of the board (reserved registers included) in Bytes
+//returns the maximum memory of the board (journal of the registers included) in Bytes
 int Agrumino::getMaxMemory()
 {
     return MAX_MEMORY;
@@ -377,9 +658,7 @@ int Agrumino::getMaxMemory()
 //returns the last address that is free. This should be used in case of sequential write only
 int Agrumino::getLastAvaiableAddress()
 {
-    int result = 0;
-    EEPROM.get(LASTFREEADD,result);
-    return (int) result;
+    return _memory.lastFree;
 }
 
 /*frees up an address, by putting 255 in it. Note that this invalidates the
@@ -394,9 +673,8 @@ bool Agrumino::free(int address, int type)
     if(type==0)
     {
         EEPROM.write(address,255);
-        EEPROM.commit();
-        EEPROM.put(FREE_MEMORY,(getFreeMemory()+1));
-        EEPROM.commit();
+        _memory.freeMemory = (getFreeMemory()+1);
+        commitMemory();
         return true;
     }
     //float case
@@ -406,9 +684,8 @@ bool Agrumino::free(int address, int type)
         EEPROM.write(address+1,255);
         EEPROM.write(address+2,255);
         EEPROM.write(address+3,255);
-        EEPROM.commit();
-        EEPROM.put(FREE_MEMORY,(getFreeMemory()+4));
-        EEPROM.commit();
+        _memory.freeMemory = (getFreeMemory()+4);
+        commitMemory();
         return true;
     }
 
@@ -420,7 +697,7 @@ bool Agrumino::free(int address, int type)
 bool Agrumino::isFree(int address)
 {
     //preventing the user from accessing reserved addresses
-    if(address<10)
+    if(address<USERSPACE)
         return false;
     if(EEPROM.read(address)==255)
         return true;
@@ -434,35 +711,42 @@ bool Agrumino::isFree(int address)
   he wants to read begins.*/
 int Agrumino::getStartAddress()
 {
-    return EEPROM.read(START_ADDRESS);
+    return _memory.start;
 }
 
 //setter for the previous address: must be handled by the user
 void Agrumino::setStartAddress(int val)
 {
-    EEPROM.put(START_ADDRESS,val);
-    EEPROM.commit();
+    _memory.start = val;
+    commitMemory();
 }
 
-//returns to the user how many hours has been passed since the last data push
+//returns to the user how many hours has been passed since the last data push (staged ones included)
 int Agrumino::getHours()
 {
-    return EEPROM.read(HOURS);
+    return _memory.hours+(_staged ? _staging.hours()-_spilledHours : 0);
 }
 
-//increaser for the hours register
+//increaser for the hours register. While staging the hour is counted in the RTC memory, with no flash commit
 void Agrumino::incrHours()
 {
-    int h = getHours();
-    EEPROM.put(HOURS,h+1);
-    EEPROM.commit();
+    if(_staged)
+    {
+        _staging.addHour();
+        return;
+    }
+    _memory.hours++;
+    commitMemory();
 }
 
 //resets the hours register
 void Agrumino::RSTHours()
 {
-    EEPROM.put(HOURS,0);
-    EEPROM.commit();
+    _memory.hours = 0;
+    if(_staged)
+        _staging.clearHours();
+    _spilledHours = 0;
+    commitMemory();
 }
 
 /*the following functions handles the sequential writing and reading of datas.
@@ -470,33 +754,26 @@ void Agrumino::RSTHours()
   possible to manually write specific bytes. If the user wants to write to specific
   bytes the arbitrary functions should be used (scroll down). It must be noted that
   the use of the sequential write functions give sense to the LASTFREEADD byte, that
-  shoudln't be used otherwise*/
+  shoudln't be used otherwise.
+  Each write reserves its bytes with reserveRecord() (updating LASTFREEADD, FREE_MEMORY
+  and DIRTY in RAM), writes the value and then commits once (or not at all inside a
+  beginBatch()/commitBatch() pair)*/
 
 bool Agrumino::intWrite(int value)
 {
-    //getting where to write
-    int lastAvaiableAddress = getLastAvaiableAddress();
-    int freeMemory = getFreeMemory(); //and free memory
-    if(freeMemory<1) //checking if there's enough memory avaiable
+    //getting where to write, updating the last free address, free memory and dirty flag
+    int lastAvaiableAddress = reserveRecord(1);
+    if(lastAvaiableAddress<0) //checking if there's enough memory avaiable
         return false;
 
-    //writing the data, updating the last free address and free memory
     EEPROM.write(lastAvaiableAddress,value);
-    EEPROM.put(FREE_MEMORY,(getFreeMemory()-1));
-    EEPROM.commit();
-    EEPROM.put(LASTFREEADD,(getLastAvaiableAddress()+1));
-    EEPROM.commit();
-
-    //setting the dirty flag
-    setDirty(true);
-    return true;
+    return commitMemory();
 }
 
 bool Agrumino::floatWrite(float value)
 {
-    int lastAvaiableAddress = getLastAvaiableAddress();
-    int freeMemory = getFreeMemory();
-    if(freeMemory<4)
+    int lastAvaiableAddress = reserveRecord(4);
+    if(lastAvaiableAddress<0)
         return false;
 
 
@@ -512,57 +789,32 @@ bool Agrumino::floatWrite(float value)
 
 
 
-    //writing the 4 bytes manually and updating the flags and addresses
+    //writing the 4 bytes manually
     EEPROM.write(lastAvaiableAddress  , u.b[0]);
     EEPROM.write(lastAvaiableAddress+1, u.b[1]);
     EEPROM.write(lastAvaiableAddress+2, u.b[2]);
     EEPROM.write(lastAvaiableAddress+3, u.b[3]);
-
-    EEPROM.put(FREE_MEMORY,(getFreeMemory()-4));
-    EEPROM.commit();
-    EEPROM.put(LASTFREEADD,(getLastAvaiableAddress()+4));
-    EEPROM.commit();
-
-    setDirty(true);
-    return true;
+    return commitMemory();
 }
 
 bool Agrumino::charWrite(char value)
 {
-    int lastAvaiableAddress = getLastAvaiableAddress();
-    int freeMemory = getFreeMemory();
-    if(freeMemory<1)
+    int lastAvaiableAddress = reserveRecord(1);
+    if(lastAvaiableAddress<0)
         return false;
 
     EEPROM.write(lastAvaiableAddress,value);
-    EEPROM.commit();
-
-    EEPROM.put(FREE_MEMORY,(getFreeMemory()-1));
-    EEPROM.commit();
-    EEPROM.put(LASTFREEADD,(getLastAvaiableAddress()+1));
-    EEPROM.commit();
-
-    setDirty(true);
-    return true;
+    return commitMemory();
 }
 
 bool Agrumino::boolWrite(bool value)
 {
-    int lastAvaiableAddress = getLastAvaiableAddress();
-    int freeMemory = getFreeMemory();
-    if(freeMemory<1)
+    int lastAvaiableAddress = reserveRecord(1);
+    if(lastAvaiableAddress<0)
         return false;
 
     EEPROM.write(lastAvaiableAddress,value);
-    EEPROM.commit();
-
-    EEPROM.put(FREE_MEMORY,(getFreeMemory()-1));
-    EEPROM.commit();
-    EEPROM.put(LASTFREEADD,(getLastAvaiableAddress()+1));
-    EEPROM.commit();
-
-    setDirty(true);
-    return true;
+    return commitMemory();
 }
 
 /*the following functions allow the user to read stored data and returns -1 in fail case*/
@@ -629,21 +881,15 @@ bool Agrumino::intArbitraryWrite(int address, int value)
     EEPROM.write(address,value);
 
     //the only case in which LASTFREEADD is still useful
-    if(address = lastAvaiableAddress)
-    {
-        EEPROM.put(LASTFREEADD,(getLastAvaiableAddress()+1));
-        EEPROM.commit();
-    }
+    if(address==lastAvaiableAddress)
+        _memory.lastFree = lastAvaiableAddress+1;
 
     //if writing on a free address we can update the free memory information
     if(avaiability)
-    {
-        EEPROM.put(FREE_MEMORY,(getFreeMemory()-1));
-        EEPROM.commit();
-    }
-    setDirty(true);
+        _memory.freeMemory = freeMemory-1;
 
-    return true;
+    _memory.dirty = true;
+    return commitMemory();
 }
 
 bool Agrumino::floatArbitraryWrite(int address, float value)
@@ -672,18 +918,12 @@ bool Agrumino::floatArbitraryWrite(int address, float value)
     EEPROM.write(address+3, u.b[3]);
 
     if(address==lastAvaiableAddress)
-    {
-        EEPROM.put(FREE_MEMORY,(getFreeMemory()));
-        EEPROM.commit();
-    }
+        _memory.lastFree = lastAvaiableAddress+4;
     if(avaiability)
-    {
-        EEPROM.put(FREE_MEMORY,(getFreeMemory()-4));
-        EEPROM.commit();
-    }
+        _memory.freeMemory = freeMemory-4;
 
-    setDirty(true);
-    return true;
+    _memory.dirty = true;
+    return commitMemory();
 }
 
 bool Agrumino::charArbitraryWrite(int address, char value)
@@ -697,22 +937,15 @@ bool Agrumino::charArbitraryWrite(int address, char value)
     bool avaiability = isFree(address);
 
     EEPROM.write(address,value);
-    EEPROM.commit();
 
-    if(address=lastAvaiableAddress)
-    {
-        EEPROM.put(LASTFREEADD,(getLastAvaiableAddress()+1));
-        EEPROM.commit();
-    }
+    if(address==lastAvaiableAddress)
+        _memory.lastFree = lastAvaiableAddress+1;
 
     if(avaiability)
-    {
-        EEPROM.put(FREE_MEMORY,(getFreeMemory()-1));
-        EEPROM.commit();
-    }
+        _memory.freeMemory = freeMemory-1;
 
-    setDirty(true);
-    return true;
+    _memory.dirty = true;
+    return commitMemory();
 }
 
 bool Agrumino::boolArbitraryWrite(int address, bool value)
@@ -726,36 +959,312 @@ bool Agrumino::boolArbitraryWrite(int address, bool value)
     bool avaiability = isFree(address);
 
     EEPROM.write(address,value);
-    EEPROM.commit();
 
     if(address==lastAvaiableAddress)
+        _memory.lastFree = lastAvaiableAddress+1;
+
+    if(avaiability)
+        _memory.freeMemory = freeMemory-1;
+
+    _memory.dirty = true;
+    return commitMemory();
+}
+
+
+/*helpers of the record templates (see appendRecord() in Agrumino.h)*/
+
+/*reserves size bytes after LASTFREEADD, updating the registers. The space dropped by
+  discardMemory() is reclaimed when the end of the memory is reached. Returns the address
+  or -1 if the memory is full*/
+int Agrumino::reserveRecord(size_t size)
+{
+    int lastAvaiableAddress = getLastAvaiableAddress();
+    int freeMemory = getFreeMemory();
+    if(freeMemory<(int)size || lastAvaiableAddress<USERSPACE || lastAvaiableAddress>MAX_MEMORY)
+        return -1;
+    if(lastAvaiableAddress+(int)size>MAX_MEMORY)
     {
-        EEPROM.put(LASTFREEADD,(getLastAvaiableAddress()+1));
-        EEPROM.commit();
+        if(!compactMemory())
+            return -1;
+        lastAvaiableAddress = getLastAvaiableAddress();
+        if(lastAvaiableAddress+(int)size>MAX_MEMORY)
+            return -1;
     }
 
-    if(avaiability)
+    _memory.freeMemory = freeMemory-(int)size;
+    _memory.lastFree = lastAvaiableAddress+(int)size;
+    _memory.dirty = true;
+    return lastAvaiableAddress;
+}
+
+/*moves the data between START_ADDRESS and LASTFREEADD back to USERSPACE, reclaiming
+  the space dropped by discardMemory(). Only changes the RAM copy: the caller commits*/
+bool Agrumino::compactMemory()
+{
+    int start = getStartAddress();
+    int lastAvaiableAddress = getLastAvaiableAddress();
+    if(start<=USERSPACE || start>lastAvaiableAddress || lastAvaiableAddress>MAX_MEMORY)
+        return false;
+
+    int used = lastAvaiableAddress-start;
+    uint8_t *data = EEPROM.getDataPtr();
+    memmove(data+USERSPACE,data+start,used);
+    memset(data+USERSPACE+used,255,MAX_MEMORY-USERSPACE-used);
+    _memory.start = USERSPACE;
+    _memory.lastFree = USERSPACE+used;
+    return true;
+}
+
+//returns the address of the index-th record from START_ADDRESS, or -1 if it hasn't been written
+int Agrumino::recordAddress(int index, size_t size)
+{
+    int address = getStartAddress()+index*(int)size;
+    if(index<0 || address<USERSPACE || address+(int)size>getLastAvaiableAddress())
+        return -1;
+    return address;
+}
+
+/*returns a pointer to START_ADDRESS in the RAM copy of the flash and the bytes stored from
+  there to LASTFREEADD, so the data can be uploaded without reading it field by field.
+  The pointer is valid until the next write: reserveRecord() can move the data back to
+  USERSPACE. Returns NULL (and length 0) if the memory isn't enabled or there's no data*/
+const uint8_t* Agrumino::getData(int &length)
+{
+    length = 0;
+    int start = getStartAddress();
+    int lastAvaiableAddress = getLastAvaiableAddress();
+    const uint8_t *data = EEPROM.getConstDataPtr();
+    if(!data || start<USERSPACE || start>=lastAvaiableAddress || lastAvaiableAddress>MAX_MEMORY)
+        return NULL;
+
+    length = lastAvaiableAddress-start;
+    return data+start;
+}
+
+//returns how many records of the given size are stored between START_ADDRESS and LASTFREEADD
+int Agrumino::countRecords(size_t size)
+{
+    int used = getLastAvaiableAddress()-getStartAddress();
+    return used>0 ? used/(int)size : 0;
+}
+
+/*the following functions store the samples compressed (AgruminoCodec.h): every sample
+  is encoded as the difference from the previous one, so the encoder state is the last
+  sample of the stream. It's kept in RAM and rebuilt by decoding the whole stream only
+  when START_ADDRESS or LASTFREEADD don't match the last append (i.e.: after a RST)*/
+
+//sets the decimals kept for temperature, illuminance and battery voltage. Applies to streams started after the call
+void Agrumino::setCompression(uint8_t temperatureDecimals, uint8_t illuminanceDecimals, uint8_t voltageDecimals)
+{
+    _compression.setPrecision(temperatureDecimals,illuminanceDecimals,voltageDecimals);
+}
+
+//appends a compressed sample after LASTFREEADD. Returns false if the memory is full or the stream is corrupted
+bool Agrumino::appendCompressed(const AgruminoSample &sample)
+{
+    if(!syncCompressed())
+        return false;
+
+    //encoding on a copy, so the state is unchanged if the sample doesn't fit
+    uint8_t buffer[AGRUMINO_CODEC_HEADER_SIZE+AGRUMINO_CODEC_MAX_SIZE];
+    size_t size = 0;
+    AgruminoCodec writer = _writer;
+    if(_writerEnd==_writerStart) //empty stream: starting it with the header
+    {
+        size = _compression.writeHeader(buffer);
+        writer.readHeader(buffer,size);
+    }
+    size += writer.encode(sample,buffer+size);
+
+    int address = reserveRecord(size);
+    if(address<0)
+        return false;
+    for(size_t i=0; i<size; i++)
+        EEPROM.write(address+i,buffer[i]);
+
+    //a reserve that compacted the memory moved the stream back to USERSPACE: same bytes, so
+    //the encoder state still holds, but the reader's address is stale
+    int start = getStartAddress();
+    if(start!=_writerStart)
     {
-        EEPROM.put(FREE_MEMORY,(getFreeMemory()-1));
-        EEPROM.commit();
+        _writerStart = start;
+        _readerIndex = -1;
     }
+    _writer = writer;
+    _writerEnd = address+size;
+    _compressedCount++;
+    return commitMemory();
+}
+
+/*reads the index-th compressed sample from START_ADDRESS. Reading the samples in order
+  decodes each of them once, going back restarts from the first one*/
+bool Agrumino::readCompressed(int index, AgruminoSample &sample)
+{
+    if(!syncCompressed() || index<0 || index>=_compressedCount)
+        return false;
+
+    const uint8_t *data = EEPROM.getConstDataPtr();
+    if(_readerIndex<0 || index<_readerIndex)
+    {
+        size_t read = _reader.readHeader(data+_writerStart,_writerEnd-_writerStart);
+        if(!read)
+            return false;
+        _readerAddress = _writerStart+read;
+        _readerIndex = 0;
+    }
+    while(_readerIndex<=index)
+    {
+        size_t read = _reader.decode(data+_readerAddress,_writerEnd-_readerAddress,sample);
+        if(!read)
+        {
+            _readerIndex = -1;
+            return false;
+        }
+        _readerAddress += read;
+        _readerIndex++;
+    }
+    return true;
+}
+
+//returns how many compressed samples are stored from START_ADDRESS
+int Agrumino::getCompressedCount()
+{
+    return syncCompressed() ? _compressedCount : 0;
+}
+
+//decodes the whole stream to rebuild the encoder state, unless the registers still match it
+bool Agrumino::syncCompressed()
+{
+    if((int)EEPROM.length()<MAX_MEMORY)
+        return false;
+    int start = getStartAddress();
+    int end = getLastAvaiableAddress();
+    if(start==_writerStart && end==_writerEnd)
+        return true;
 
-    setDirty(true);
+    _writerStart = start;
+    _writerEnd = start;
+    _compressedCount = 0;
+    _readerIndex = -1;
+    if(start<USERSPACE || end<start || end>MAX_MEMORY)
+        return false;
+    if(end==start) //empty: the header is written by the first append
+        return true;
+
+    const uint8_t *data = EEPROM.getConstDataPtr();
+    size_t read = _writer.readHeader(data+start,end-start);
+    if(!read)
+        return false;
+    int address = start+read;
+    int count = 0;
+    while(address<end)
+    {
+        AgruminoSample sample;
+        read = _writer.decode(data+address,end-address,sample);
+        if(!read)
+            return false;
+        address += read;
+        count++;
+    }
+    _writerEnd = end;
+    _compressedCount = count;
     return true;
 }
 
+/*the following functions expose the append-only flash log (FlashLog.h). Unlike the
+  EEPROM functions above, appending a record doesn't erase anything: records are
+  programmed in the erased space of a ring of sectors, and a sector is erased only
+  when the ring wraps around (the oldest records are then dropped). All the records
+  of the log have the same size, decided by enableLog()*/
+
+//mounts the log. Must be called (after every RST) before the other log functions.
+//A log written with another record size makes it fail (the records are kept) unless
+//clearMismatch, or until clearLog()
+bool Agrumino::enableLog(size_t recordSize, bool clearMismatch)
+{
+    _log = FlashLog.begin(recordSize, clearMismatch);
+    return _log;
+}
+
+//appends a record of the size passed to enableLog()
+bool Agrumino::logWrite(const void *record)
+{
+    return FlashLog.append(record);
+}
+
+//reads the record at the given index, 0 being the oldest one. Returns false for a missing or corrupted record
+bool Agrumino::logRead(unsigned long index, void *record)
+{
+    return FlashLog.read(index, record);
+}
+
+//returns how many records are in the log
+unsigned long Agrumino::getLogCount()
+{
+    return FlashLog.count();
+}
+
+//returns how many records fit in the log before the oldest ones get overwritten
+unsigned long Agrumino::getLogCapacity()
+{
+    return FlashLog.capacity();
+}
+
+//drops all the records of the log (also the ones of another size refused by enableLog())
+bool Agrumino::clearLog()
+{
+    _log = FlashLog.clear();
+    return _log;
+}
 
 void Agrumino::initWire() {
-  Wire.begin(PIN_SDA, PIN_SCL);
+  i2cBus.begin(PIN_SDA, PIN_SCL);
 }
 
 void Agrumino::initBoard() {
   initWire();
-  initLuxSensor();  // Boot time depends on the selected ADC resolution (16bit first reading after ~90ms)
-  initSoilSensor(); // First reading after ~30ms
-  initTempSensor(); // First reading after ~?ms
-  initGpioExpander(); // First operation after ~?ms
-  delay(90); // Ensure that the ICs are init properly
+  uint8_t sensors = 0;
+  if (initLuxSensor()) sensors |= SENSOR_LUX;  // First reading after ~6ms in the shade (8 bit probe, then 12 bit)
+  if (initSoilSensor()) sensors |= SENSOR_SOIL; // First reading after ~30ms
+  if (initTempSensor()) sensors |= SENSOR_TEMP; // First reading after ~60ms (one shot at 10bit)
+  if (initGpioExpander()) sensors |= SENSOR_GPIO_EXP; // First operation after ~?ms
+  // No blind delay: the first readings wait for their sensor (see readLux() and waitSensor())
+  _pendingSensors = SENSOR_SOIL;
+
+  AgruminoWakeState state;
+  memset(&state, 0, sizeof(state));
+  state.sensors = sensors;
+  state.crc = wakeStateCrc(sensors);
+  state.soilFilter = _soilFilterPersistent ? mcpSoilSensor.getFilterState() : FILTER_EMPTY;
+  ESP.rtcUserMemoryWrite(RTC_WAKE_BLOCK, (uint32_t *) &state, sizeof(state));
+}
+
+// Updates the soil filter state in the wake state, if there is a valid one
+void Agrumino::saveSoilFilter() {
+  AgruminoWakeState state;
+  if (ESP.rtcUserMemoryRead(RTC_WAKE_BLOCK, (uint32_t *) &state, sizeof(state)) && state.crc == wakeStateCrc(state.sensors)) {
+    state.soilFilter = mcpSoilSensor.getFilterState();
+    ESP.rtcUserMemoryWrite(RTC_WAKE_BLOCK, (uint32_t *) &state, sizeof(state));
+  }
+}
+
+// Init of a wake-up from deep sleep: the sensors found by the last full init
+// are configured straight away, with no pings and no log. Returns false, and
+// a full init is needed, if the wake state isn't valid (power loss, new
+// configuration) or if a sensor doesn't answer anymore
+boolean Agrumino::fastInitBoard() {
+  AgruminoWakeState state;
+  if (!ESP.rtcUserMemoryRead(RTC_WAKE_BLOCK, (uint32_t *) &state, sizeof(state)) || state.crc != wakeStateCrc(state.sensors)) {
+    return false;
+  }
+  initWire();
+  if ((state.sensors & SENSOR_LUX) && !configureLuxSensor()) return false;
+  if (state.sensors & SENSOR_SOIL) configureSoilSensor();
+  if ((state.sensors & SENSOR_SOIL) && _soilFilterPersistent) mcpSoilSensor.setFilterState(state.soilFilter);
+  if (state.sensors & SENSOR_TEMP) configureTempSensor();
+  if ((state.sensors & SENSOR_GPIO_EXP) && !configureGpioExpander()) return false;
+  _pendingSensors = SENSOR_SOIL;
+  return true;
 }
 
 void Agrumino::setupGpioModes() {
@@ -778,3 +1287,92 @@ void Agrumino::printLogo() {
   Serial.println("  \\_/_________________________________________/");
   Serial.println("");
 }
+
+/*the following functions stage the samples in the RTC memory, that survives the deep
+  sleep and is written with no erase: most wake-ups don't touch the flash at all. The
+  staged samples and hours are moved to the flash by flushStaging(), in a single commit.
+  A power loss (not a deep sleep) drops the staged samples*/
+
+/*loads the staging buffer left by the previous wake-up. compressed chooses how the
+  samples are spilled: appendCompressed() or appendRecord(). Call it after enableMemory()*/
+bool Agrumino::enableStaging(bool compressed)
+{
+    _stagingCompressed = compressed;
+    _staged = _staging.begin(sizeof(AgruminoSample));
+    return _staged;
+}
+
+//stages a sample, spilling the buffer to the flash first if it's full. Without staging the sample goes straight to the flash
+bool Agrumino::stageSample(const AgruminoSample &sample)
+{
+    if(!_staged)
+        return _stagingCompressed ? appendCompressed(sample) : appendRecord(sample);
+    if(_staging.full() && !flushStaging() && _staging.full())
+        return false;
+    return _staging.push(&sample);
+}
+
+/*appends the staged samples to the flash and adds the staged hours to the hours register,
+  all in a single commit. The samples that don't fit stay staged and false is returned.
+  The staged samples are dropped only once committed: if the commit fails they stay staged
+  (a deep sleep drops the RAM copy of the flash, not the RTC memory) and, in the same
+  wake-up, the next call commits the RAM copy again without appending them twice*/
+bool Agrumino::flushStaging()
+{
+    if(!_staged)
+        return true;
+    int count = _staging.count();
+    if(count==0 && _staging.hours()==0)
+        return true;
+
+    bool batch = _batch;
+    _batch = true;
+    int spilled = _spilled;
+    AgruminoSample sample;
+    while(spilled<count && _staging.read(spilled,&sample))
+    {
+        if(!(_stagingCompressed ? appendCompressed(sample) : appendRecord(sample)))
+            break;
+        spilled++;
+    }
+    _memory.hours += _staging.hours()-_spilledHours;
+    _batch = batch;
+    if(!commitMemory())
+    {
+        //only in the RAM copy of the flash: kept staged
+        _spilled = spilled;
+        _spilledHours = _staging.hours();
+        return false;
+    }
+
+    _staging.drop(spilled);
+    _staging.clearHours();
+    _spilled = 0;
+    _spilledHours = 0;
+    return spilled==count;
+}
+
+/*the memory has been dropped, together with the staged samples and hours that a failed
+  commit left in its RAM copy: they are dropped from the staging buffer too*/
+void Agrumino::dropSpilled()
+{
+    if(_staged)
+    {
+        _staging.drop(_spilled);
+        _staging.clearHours();
+    }
+    _spilled = 0;
+    _spilledHours = 0;
+}
+
+//returns how many samples are staged and not yet in the flash (nor in its RAM copy, after a failed commit)
+int Agrumino::getStagedCount()
+{
+    return _staged ? _staging.count()-_spilled : 0;
+}
+
+//reads the index-th staged sample, the oldest first
+bool Agrumino::readStaged(int index, AgruminoSample &sample)
+{
+    return _staged && index>=0 && index<getStagedCount() && _staging.read(_spilled+index,&sample);
+}
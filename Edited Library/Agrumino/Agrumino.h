@@ -15,6 +15,23 @@
 
 #include "Arduino.h"
 #include "EEPROM.h"
+#include "FlashLog.h"
+#include "AgruminoRecord.h"
+#include "AgruminoCodec.h"
+#include "AgruminoStaging.h"
+#include "AgruminoClock.h"
+#include "libraries/I2CBus/I2CBus.h"
+
+// Registers of the flash memory, saved all together in the EEPROM journal (see enableMemory())
+struct AgruminoMemoryHeader {
+  int32_t lastFree;    // the last free address (reliable only if writing sequentially)
+  int32_t freeMemory;  // how many Bytes of memory are free
+  int32_t start;       // starting address to read the datas (for RST survive)
+  int32_t hours;       // amount of hours since last data push
+  uint16_t generation; // increased every time the data is initialized or discarded
+  uint8_t dirty;       // if there's some data that need to be pushed. Must be manually handled by the user
+  uint8_t reserved;
+};
 
 class Agrumino {
 
@@ -23,6 +40,11 @@ class Agrumino {
     Agrumino();
     void setup();
     void deepSleepSec(unsigned int sec);
+
+    // Device clock, kept across the deep sleep of deepSleepSec() (see AgruminoClock.h)
+    uint32_t getTime(); // Seconds, the time of the samples
+    bool setTime(uint32_t unixTime); // Anchors the clock to the time of a server
+    uint32_t getEpoch(); // Unix time of the device time 0, 0 if setTime() was never called
     
     // Public methods GPIO
     void turnWateringOn();
@@ -33,8 +55,10 @@ class Agrumino {
     boolean isBoardOn();
     void turnBoardOn(); // Also call initBoard()
     void turnBoardOff(); 
-    float readBatteryVoltage(); 
+    float readBatteryVoltage(); // The battery readings share one measurement per turnBoardOn()
     unsigned int readBatteryLevel();
+    unsigned int readBatteryMilliVolt();
+    void refreshBattery(); // New measurement for the battery readings, e.g. with the board kept on
     
     // Public methods I2C
     float readTempC();
@@ -43,16 +67,22 @@ class Agrumino {
     void turnLedOff(); // Default Off
     boolean isLedOn();
     void toggleLed();
+    I2CDeviceStats getI2CStats(uint8_t address); // 0x48 temperature, 0x4D soil, 0x44 light, 0x41 GPIO expander
+    uint32_t getI2CFailures();
     unsigned int readSoil();
     unsigned int readSoilRaw();
+    void setSoilFilterPersistent(boolean persistent); // Keep the soil smoothing across the deep sleep (RTC memory), call it before turnBoardOn()
     void calibrateSoilWater();
     void calibrateSoilAir();
     void calibrateSoilWater(unsigned int rawValue);
     void calibrateSoilAir(unsigned int rawValue);
     float readLux();
+    boolean sampleAll(AgruminoSample &sample); // All the readings at once, in the time of the slowest sensor
 
     //methods that allows to read/write from the ESP8266 flash in order to reduce Wifi connection number and to store datas and configurations
     bool initializeMemory();
+    bool discardMemory();
+    unsigned int getGeneration();
     bool enableMemory();
     bool getDirty();
     void setDirty(bool isDirty);
@@ -78,6 +108,69 @@ class Agrumino {
     int getHours();
     void incrHours();
     void RSTHours();
+    void beginBatch();
+    bool commitBatch();
+    EEPROMStats getFlashStats();
+
+    //append-only log of fixed-size records on a ring of flash sectors (see FlashLog.h)
+    bool enableLog(size_t recordSize, bool clearMismatch = false);
+    bool logWrite(const void *record);
+    bool logRead(unsigned long index, void *record);
+    unsigned long getLogCount();
+    unsigned long getLogCapacity();
+    bool clearLog();
+
+    /*typed records (see AgruminoRecord.h), written and read whole. Records are appended
+      after LASTFREEADD and indexed from START_ADDRESS, or go to the flash log once
+      enableLog(sizeof(record)) has been called*/
+    template<typename T> bool appendRecord(const T &record) {
+      if (_log)
+        return sizeof(T) == FlashLog.recordSize() && FlashLog.append(&record);
+      int address = reserveRecord(sizeof(T));
+      if (address < 0)
+        return false;
+      EEPROM.put(address, record);
+      return commitMemory();
+    }
+    template<typename T> bool readRecord(int index, T &record) {
+      if (_log)
+        return sizeof(T) == FlashLog.recordSize() && FlashLog.read(index, &record);
+      int address = recordAddress(index, sizeof(T));
+      if (address < 0)
+        return false;
+      EEPROM.get(address, record);
+      return true;
+    }
+    template<typename T> int getRecordCount() {
+      return _log ? (int) FlashLog.count() : countRecords(sizeof(T));
+    }
+
+    /*read-only views of the data between START_ADDRESS and LASTFREEADD, straight on the
+      RAM copy of the flash: nothing is copied. Empty for the flash log*/
+    const uint8_t* getData(int &length);
+    template<typename T> AgruminoRecordSpan<T> getRecords() {
+      int length = 0;
+      const uint8_t *data = _log ? 0 : getData(length);
+      return AgruminoRecordSpan<T>(data, length);
+    }
+
+    /*compressed samples (see AgruminoCodec.h), stored as differences from the previous
+      one in about a third of the space of appendRecord(). The stream starts at
+      START_ADDRESS and must be read back in order to be cheap*/
+    void setCompression(uint8_t temperatureDecimals, uint8_t illuminanceDecimals, uint8_t voltageDecimals);
+    bool appendCompressed(const AgruminoSample &sample);
+    bool readCompressed(int index, AgruminoSample &sample);
+    int getCompressedCount();
+
+    /*samples staged in the RTC memory (see AgruminoStaging.h): stageSample() doesn't touch
+      the flash, the staged samples are appended (compressed or as records) all in a single
+      commit by flushStaging(), called when the staging buffer is full and before an upload.
+      While staging, incrHours() counts in the RTC memory too*/
+    bool enableStaging(bool compressed);
+    bool stageSample(const AgruminoSample &sample);
+    bool flushStaging();
+    int getStagedCount();
+    bool readStaged(int index, AgruminoSample &sample);
 
  
   private:
@@ -85,19 +178,56 @@ class Agrumino {
     void setupGpioModes();
     void printLogo();
     void initBoard();
+    boolean fastInitBoard();
     void initWire();
-    void initGpioExpander();
-    void initTempSensor();
-    void initSoilSensor();
-    void initLuxSensor();
-    float readBatteryVoltageSingleShot(); 
+    boolean initGpioExpander();
+    boolean initTempSensor();
+    boolean initSoilSensor();
+    boolean initLuxSensor();
+    boolean configureGpioExpander();
+    void configureTempSensor();
+    void configureSoilSensor();
+    boolean configureLuxSensor();
+    boolean pollLux(float &lux);
+    boolean sensorReady(uint8_t sensor, unsigned long readyMillis);
+    void waitSensor(uint8_t sensor, unsigned long readyMillis);
+    void saveSoilFilter();
+    unsigned int batteryLevel(unsigned int milliVolt);
+    unsigned int measureBattery();
     boolean checkBattery();
-
+    bool commitMemory();
+    int reserveRecord(size_t size);
+    bool compactMemory();
+    void dropSpilled();
+    int recordAddress(int index, size_t size);
+    int countRecords(size_t size);
+    bool syncCompressed();
 
 
     // Private variables
     unsigned int _soilRawAir;
     unsigned int _soilRawWater;
+    unsigned long _boardOnMillis; // millis() when the board was turned on
+    uint8_t _pendingSensors;      // sensors whose first reading may not be ready yet (see waitSensor())
+    uint16_t _batteryMilliVolt;   // battery measured since the board was turned on, 0 if not yet
+    boolean _soilFilterPersistent; // the soil filter state is kept in the wake state (see setSoilFilterPersistent())
+    bool _batch; // true between beginBatch() and commitBatch(): flash commits are deferred
+    bool _log;   // true after enableLog(): records go to the flash log
+    AgruminoMemoryHeader _memory; // RAM copy of the registers, saved by every commit
+    AgruminoCodec _compression; // precision of the next compressed stream
+    AgruminoCodec _writer;      // state after the last compressed sample
+    AgruminoCodec _reader;      // state after the last sample read by readCompressed()
+    int _writerStart;           // START_ADDRESS and LASTFREEADD of the stream known by _writer
+    int _writerEnd;
+    int _compressedCount;
+    int _readerAddress;         // address and index of the next sample to be read by _reader (-1: to restart)
+    int _readerIndex;
+    AgruminoClock _clock;
+    AgruminoStaging _staging;
+    bool _staged;               // true after enableStaging()
+    bool _stagingCompressed;    // flushStaging() uses appendCompressed() instead of appendRecord()
+    int _spilled;               // staged samples and hours already in the RAM copy of the flash, whose commit failed
+    uint16_t _spilledHours;
 };
 
 #endif
@@ -0,0 +1,107 @@
+/*
+  AgruminoClock.cpp - Device clock kept across the deep sleep
+  For details @see AgruminoClock.h
+*/
+
+#include "AgruminoClock.h"
+#include "AgruminoStaging.h"
+#include "EEPROM.h"
+
+extern "C" {
+#include "user_interface.h"
+}
+
+static_assert(sizeof(AgruminoClockState) == AGRUMINO_CLOCK_RTC_SIZE, "AgruminoClockState layout changed");
+static_assert(AGRUMINO_CLOCK_RTC_BLOCK + AGRUMINO_CLOCK_RTC_SIZE / 4 <= AGRUMINO_STAGING_BLOCK, "The clock overlaps the staging buffer");
+
+AgruminoClock::AgruminoClock()
+: _base(0)
+, _begun(false)
+{
+  memset(&_state, 0, sizeof(_state));
+}
+
+// Takes the clock of the previous wake-up and adds the sleep. Call it at
+// every wake-up (Agrumino::setup() does), before now().
+void AgruminoClock::begin() {
+  if (_begun)
+    return;
+  _begun = true;
+
+  if (!ESP.rtcUserMemoryRead(AGRUMINO_CLOCK_RTC_BLOCK, (uint32_t *) &_state, sizeof(_state)) || _state.crc != checksum()) {
+    memset(&_state, 0, sizeof(_state)); // Power loss: from 1 s (0 is no time), not anchored
+    _state.seconds = 1;
+  }
+  _base = (uint64_t) _state.seconds * 1000 + _state.millis;
+  if (_state.sleepMs) {
+    // The SDK counted the RTC ticks with the period at the sleep, they lasted the mean of the two periods
+    uint64_t slept = _state.sleepMs;
+    uint32_t cali = system_rtc_clock_cali_proc();
+    if (_state.cali && cali) {
+      slept = slept * (_state.cali + cali) / (2 * (uint64_t) _state.cali);
+    }
+    slept += (int64_t) slept * _state.drift / 1000000;
+    _base += slept + AGRUMINO_CLOCK_BOOT_MS;
+  } else {
+    _state.epoch = 0; // Unknown sleep: the time goes on from the last one known, the anchor is wrong now
+  }
+
+  // A reset or a deep sleep not through sleep() finds no sleep on the next wake-up
+  _state.sleepMs = 0;
+  save();
+}
+
+// Saves the clock before a deep sleep of ms milliseconds: the next begin()
+// adds it. Call it right before ESP.deepSleep() (Agrumino::deepSleepSec() does)
+void AgruminoClock::sleep(uint32_t ms) {
+  begin();
+  _state.sleepMs = ms;
+  _state.cali = system_rtc_clock_cali_proc();
+  save();
+}
+
+// Seconds of the device clock. Saved too, so the clock never goes back even
+// if the board is reset before sleep()
+uint32_t AgruminoClock::now() {
+  begin();
+  uint32_t time = (uint32_t) ((_base + millis()) / 1000);
+  if (time != _state.seconds) {
+    save();
+  }
+  return time;
+}
+
+// Anchors the clock to unixTime, the time now, and learns the drift from the
+// error of the previous anchor. Returns false if unixTime can't be right.
+bool AgruminoClock::setTime(uint32_t unixTime) {
+  uint32_t time = now();
+  if (unixTime < AGRUMINO_CLOCK_MIN_UNIX || unixTime <= time)
+    return false;
+
+  if (_state.epoch) {
+    uint32_t elapsed = time - _state.anchoredAt;
+    if (elapsed < AGRUMINO_CLOCK_LEARN_SEC)
+      return true;
+    int64_t error = (int64_t) unixTime - ((int64_t) _state.epoch + time); // > 0: the clock is late
+    int64_t drift = _state.drift + error * 1000000 / elapsed / 2;
+    if (drift >= -AGRUMINO_CLOCK_MAX_DRIFT_PPM && drift <= AGRUMINO_CLOCK_MAX_DRIFT_PPM) {
+      _state.drift = (int16_t) drift;
+    }
+  }
+  _state.epoch = unixTime - time;
+  _state.anchoredAt = time;
+  save();
+  return true;
+}
+
+void AgruminoClock::save() {
+  uint64_t time = _base + millis();
+  _state.seconds = (uint32_t) (time / 1000);
+  _state.millis = (uint16_t) (time % 1000);
+  _state.crc = checksum();
+  ESP.rtcUserMemoryWrite(AGRUMINO_CLOCK_RTC_BLOCK, (uint32_t *) &_state, sizeof(_state));
+}
+
+uint32_t AgruminoClock::checksum() {
+  return EEPROMClass::crc32((const uint8_t *) &_state + sizeof(_state.crc), sizeof(_state) - sizeof(_state.crc));
+}
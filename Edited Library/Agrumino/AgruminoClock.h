@@ -0,0 +1,91 @@
+/*
+  AgruminoClock.h - Device clock kept across the deep sleep
+  Created for the AgruminoFlash project.
+
+  millis() starts again from 0 at every wake-up and the ESP8266 has no
+  battery backed clock: the buffered samples had no time but their order.
+  AgruminoClock counts the seconds since the first boot in the RTC user
+  memory: at every wake-up it adds the deep sleep requested by sleep() and
+  the awake time of the previous wake-up (millis() at the sleep, plus the
+  boot before setup()).
+
+  The deep sleep is timed by the RTC slow clock (~150 kHz), whose period
+  changes with the temperature and the supply by a few percent: the SDK
+  turns the requested time into RTC ticks with the period measured at the
+  sleep, and the board wakes up earlier or later. The period is measured
+  again at the wake-up (system_rtc_clock_cali_proc()) and the sleep is
+  taken at the mean of the two periods. What the calibration misses is
+  learnt as a drift (ppm) every time the clock is anchored: setTime() with
+  the time of a server (the Date of a HTTP reply, NTP...) compares it with
+  the time the clock expected since the previous anchor, and half of the
+  error goes to the drift (the server time has a resolution of 1 s).
+
+  The device clock never goes back and is not changed by setTime(): the
+  samples carry the device time, turned into unix time with toUnix() (the
+  last anchor) when uploaded, so every buffered sample gets the correction
+  of the latest anchor.
+
+  The state is kept in the RTC user memory, from block
+  AGRUMINO_CLOCK_RTC_BLOCK (after the WiFi cache of AgruminoWiFi.h, before
+  the staging buffer of AgruminoStaging.h). After a power loss the clock
+  starts again from 1 s (a time of 0 is a sample without a time), not
+  anchored; a wake-up that didn't go to sleep
+  through sleep() (ESP.deepSleep(), a reset) keeps counting from the last
+  known time, without the sleep, and drops the anchor.
+
+  Example:
+    clock.begin();                    // at every wake-up
+    sample.time = clock.now();
+    ...upload, then with the server time:
+    clock.setTime(serverTime);
+    clock.sleep(3600000UL);
+    ESP.deepSleep(3600000000ULL);
+*/
+
+#ifndef AgruminoClock_h
+#define AgruminoClock_h
+
+#include "Arduino.h"
+
+#define AGRUMINO_CLOCK_RTC_BLOCK         41  // First 4 bytes block of the RTC user memory used
+#define AGRUMINO_CLOCK_RTC_SIZE          28  // sizeof(AgruminoClockState)
+#define AGRUMINO_CLOCK_BOOT_MS          100  // From the deep sleep wake-up to setup(): ROM, boot loader and SDK init
+#define AGRUMINO_CLOCK_LEARN_SEC       3600  // A closer anchor is ignored: 1 s of error (the resolution of a Date) is 278 ppm in 1 h
+#define AGRUMINO_CLOCK_MAX_DRIFT_PPM  20000  // Beyond this the error isn't drift (e.g. a wrong server time): not learnt
+#define AGRUMINO_CLOCK_MIN_UNIX  1577836800  // 2020-01-01, an older time is a server without a clock
+
+struct AgruminoClockState {
+  uint32_t crc;         // CRC-32 of the rest
+  uint32_t seconds;     // Device clock when last saved (begin(), now(), setTime(), sleep())
+  uint16_t millis;
+  int16_t drift;        // ppm of the deep sleep left after the calibration
+  uint32_t sleepMs;     // Requested by sleep(), 0 if the board didn't go to sleep through sleep()
+  uint32_t cali;        // system_rtc_clock_cali_proc() at the sleep: RTC clock period, us Q12
+  uint32_t epoch;       // Unix time of device clock 0, 0 if not anchored
+  uint32_t anchoredAt;  // Device clock of the last setTime()
+};
+
+class AgruminoClock {
+public:
+  AgruminoClock();
+
+  void begin();
+  void sleep(uint32_t ms);
+
+  uint32_t now();
+  bool setTime(uint32_t unixTime);
+  bool isAnchored() {return _state.epoch != 0;}
+  uint32_t getEpoch() {return _state.epoch;} // Unix time of device clock 0, 0 if not anchored
+  uint32_t toUnix(uint32_t time) {return _state.epoch ? _state.epoch + time : 0;}
+  int16_t getDrift() {return _state.drift;}
+
+protected:
+  void save();
+  uint32_t checksum();
+
+  AgruminoClockState _state;
+  uint64_t _base;       // Device clock (ms) at millis() 0
+  bool _begun;
+};
+
+#endif
@@ -0,0 +1,140 @@
+/*
+  AgruminoCodec.cpp - Compressed encoding of the Agrumino samples
+  For details @see AgruminoCodec.h
+*/
+
+#include "AgruminoCodec.h"
+#include <math.h>
+#include <string.h>
+
+#define CODEC_LIMIT 0x3FFFFFFF // Quantized values are clamped to +-2^30, so a difference always fits an int32
+
+static const float powersOfTen[AGRUMINO_CODEC_MAX_DECIMALS + 1] = {1, 10, 100, 1000, 10000, 100000, 1000000};
+
+static size_t putVarint(uint8_t *out, int32_t value) {
+  uint32_t zigzag = ((uint32_t) value << 1) ^ (uint32_t) (value >> 31);
+  size_t size = 0;
+  while (zigzag >= 0x80) {
+    out[size++] = (uint8_t) (zigzag | 0x80);
+    zigzag >>= 7;
+  }
+  out[size++] = (uint8_t) zigzag;
+  return size;
+}
+
+// Returns the bytes read, 0 if the varint is truncated or longer than 5 bytes
+static size_t getVarint(const uint8_t *in, size_t size, int32_t &value) {
+  uint32_t zigzag = 0;
+  for (size_t i = 0; i < size && i < 5; i++) {
+    zigzag |= (uint32_t) (in[i] & 0x7F) << (7 * i);
+    if (!(in[i] & 0x80)) {
+      value = (int32_t) (zigzag >> 1) ^ -(int32_t) (zigzag & 1);
+      return i + 1;
+    }
+  }
+  return 0;
+}
+
+AgruminoCodec::AgruminoCodec(uint8_t temperatureDecimals, uint8_t illuminanceDecimals, uint8_t voltageDecimals)
+{
+  setPrecision(temperatureDecimals, illuminanceDecimals, voltageDecimals);
+}
+
+// Decimals kept for the float fields (soil and battery level are integers).
+// Resets the codec: the next sample is encoded as a difference from zero.
+void AgruminoCodec::setPrecision(uint8_t temperatureDecimals, uint8_t illuminanceDecimals, uint8_t voltageDecimals) {
+  _time = true;
+  _temperatureDecimals = temperatureDecimals < AGRUMINO_CODEC_MAX_DECIMALS ? temperatureDecimals : AGRUMINO_CODEC_MAX_DECIMALS;
+  _illuminanceDecimals = illuminanceDecimals < AGRUMINO_CODEC_MAX_DECIMALS ? illuminanceDecimals : AGRUMINO_CODEC_MAX_DECIMALS;
+  _voltageDecimals = voltageDecimals < AGRUMINO_CODEC_MAX_DECIMALS ? voltageDecimals : AGRUMINO_CODEC_MAX_DECIMALS;
+  reset();
+}
+
+void AgruminoCodec::reset() {
+  memset(_previous, 0, sizeof(_previous));
+}
+
+// Writes the stream header (AGRUMINO_CODEC_HEADER_SIZE bytes) and resets the codec
+size_t AgruminoCodec::writeHeader(uint8_t *out) {
+  out[0] = _temperatureDecimals | (_time ? AGRUMINO_CODEC_TIME : 0);
+  out[1] = _illuminanceDecimals;
+  out[2] = _voltageDecimals;
+  reset();
+  return AGRUMINO_CODEC_HEADER_SIZE;
+}
+
+// Takes the precision from a stream header. Returns the bytes read, 0 if the header isn't valid
+size_t AgruminoCodec::readHeader(const uint8_t *in, size_t size) {
+  if (size < AGRUMINO_CODEC_HEADER_SIZE)
+    return 0;
+  uint8_t temperatureDecimals = in[0] & ~AGRUMINO_CODEC_TIME;
+  if (temperatureDecimals > AGRUMINO_CODEC_MAX_DECIMALS || in[1] > AGRUMINO_CODEC_MAX_DECIMALS || in[2] > AGRUMINO_CODEC_MAX_DECIMALS)
+    return 0;
+  setPrecision(temperatureDecimals, in[1], in[2]);
+  _time = in[0] & AGRUMINO_CODEC_TIME;
+  return AGRUMINO_CODEC_HEADER_SIZE;
+}
+
+// Encodes the sample as a difference from the previous one. out must hold
+// AGRUMINO_CODEC_MAX_SIZE bytes. Returns the bytes written.
+size_t AgruminoCodec::encode(const AgruminoSample &sample, uint8_t *out) {
+  int32_t fields[AGRUMINO_CODEC_FIELDS] = {
+    (sample.isAttachedToUSB ? 1 : 0) | (sample.isBatteryCharging ? 2 : 0) | (sample.isButtonPressed ? 4 : 0),
+    quantize(sample.temperature, _temperatureDecimals),
+    quantize(sample.soilMoisture, 0),
+    quantize(sample.illuminance, _illuminanceDecimals),
+    quantize(sample.batteryVoltage, _voltageDecimals),
+    sample.batteryLevel,
+    (int32_t) sample.time // The difference wraps like the time
+  };
+
+  size_t size = 0;
+  for (int i = 0; i < fieldCount(); i++) {
+    size += putVarint(out + size, (int32_t) ((uint32_t) fields[i] - (uint32_t) _previous[i]));
+    _previous[i] = fields[i];
+  }
+  return size;
+}
+
+// Decodes the next sample of the stream. Returns the bytes read, 0 if the
+// stream is truncated or corrupted (the codec is left unchanged).
+size_t AgruminoCodec::decode(const uint8_t *in, size_t size, AgruminoSample &sample) {
+  int32_t fields[AGRUMINO_CODEC_FIELDS];
+  fields[6] = 0;
+  size_t read = 0;
+  for (int i = 0; i < fieldCount(); i++) {
+    int32_t delta;
+    size_t length = getVarint(in + read, size - read, delta);
+    if (!length)
+      return 0;
+    read += length;
+    fields[i] = (int32_t) ((uint32_t) _previous[i] + (uint32_t) delta);
+  }
+  if ((fields[0] & ~7) || fields[5] < 0 || fields[5] > 0xFF)
+    return 0;
+
+  memcpy(_previous, fields, sizeof(_previous));
+  sample.isAttachedToUSB = fields[0] & 1;
+  sample.isBatteryCharging = fields[0] & 2;
+  sample.isButtonPressed = fields[0] & 4;
+  sample.temperature = dequantize(fields[1], _temperatureDecimals);
+  sample.soilMoisture = dequantize(fields[2], 0);
+  sample.illuminance = dequantize(fields[3], _illuminanceDecimals);
+  sample.batteryVoltage = dequantize(fields[4], _voltageDecimals);
+  sample.batteryLevel = fields[5];
+  sample.time = (uint32_t) fields[6];
+  return read;
+}
+
+int32_t AgruminoCodec::quantize(float value, uint8_t decimals) {
+  float scaled = roundf(value * powersOfTen[decimals]);
+  if (!(scaled > -CODEC_LIMIT)) // NaN included
+    return -CODEC_LIMIT;
+  if (scaled >= CODEC_LIMIT)
+    return CODEC_LIMIT;
+  return (int32_t) scaled;
+}
+
+float AgruminoCodec::dequantize(int32_t value, uint8_t decimals) {
+  return value / powersOfTen[decimals];
+}
@@ -0,0 +1,62 @@
+/*
+  AgruminoCodec.h - Compressed encoding of the Agrumino samples
+  Created for the AgruminoFlash project.
+
+  An AgruminoSample takes 24 bytes in flash, most of them full 4 bytes
+  floats for values that change little from one hour to the next. The
+  codec turns every field into an integer (fixed point with a configurable
+  number of decimals), subtracts the value of the previous sample and
+  stores the difference as a zig-zag varint: small differences, positive
+  or negative, take a single byte. A typical hourly sample takes 8-11
+  bytes, 2 of them the time (an hour from the previous sample).
+
+  Stream layout:
+    [temperature decimals][illuminance decimals][voltage decimals]  header
+    [flags][temperature][soil][illuminance][voltage][battery level][time]
+                                                    one varint per field,
+                                                    for every sample
+  The first sample after the header is stored as a difference from zero.
+  The flags field packs isAttachedToUSB, isBatteryCharging and
+  isButtonPressed in its bits 0-2. The streams written before the samples
+  had a time have no time field, and no AGRUMINO_CODEC_TIME in the first
+  byte of the header: they are still read, with time 0.
+*/
+
+#ifndef AgruminoCodec_h
+#define AgruminoCodec_h
+
+#include <stddef.h>
+#include <stdint.h>
+#include "AgruminoRecord.h"
+
+#define AGRUMINO_CODEC_FIELDS         7
+#define AGRUMINO_CODEC_HEADER_SIZE    3
+#define AGRUMINO_CODEC_TIME        0x80 // Header flag (with the temperature decimals): the samples have the time field
+#define AGRUMINO_CODEC_MAX_SIZE      (AGRUMINO_CODEC_FIELDS * 5) // Worst case of encode(), 5 bytes per varint
+#define AGRUMINO_CODEC_MAX_DECIMALS   6
+
+class AgruminoCodec {
+public:
+  AgruminoCodec(uint8_t temperatureDecimals = 2, uint8_t illuminanceDecimals = 0, uint8_t voltageDecimals = 3);
+
+  void setPrecision(uint8_t temperatureDecimals, uint8_t illuminanceDecimals, uint8_t voltageDecimals);
+  void reset();
+
+  size_t writeHeader(uint8_t *out);
+  size_t readHeader(const uint8_t *in, size_t size);
+  size_t encode(const AgruminoSample &sample, uint8_t *out);
+  size_t decode(const uint8_t *in, size_t size, AgruminoSample &sample);
+
+protected:
+  int fieldCount() {return _time ? AGRUMINO_CODEC_FIELDS : AGRUMINO_CODEC_FIELDS - 1;}
+  int32_t quantize(float value, uint8_t decimals);
+  float dequantize(int32_t value, uint8_t decimals);
+
+  uint8_t _temperatureDecimals;
+  uint8_t _illuminanceDecimals;
+  uint8_t _voltageDecimals;
+  bool _time;                               // The stream has the time field
+  int32_t _previous[AGRUMINO_CODEC_FIELDS]; // Quantized fields of the last sample encoded/decoded
+};
+
+#endif
@@ -0,0 +1,104 @@
+/*
+  AgruminoFlushPolicy.cpp - Decides at every wake-up whether to keep buffering
+  the samples in flash or to upload them
+  For details @see AgruminoFlushPolicy.h
+*/
+
+#include "AgruminoFlushPolicy.h"
+
+#define FLUSH_MIN_LUX 10.0 // Below this the illuminance drift is relative to 10 lux (night readings are noise)
+
+AgruminoFlushPolicy::AgruminoFlushPolicy()
+: _minHours(1)
+, _maxHours(4)
+, _lowBatteryLevel(20)
+, _lowBatteryHours(24)
+, _temperatureDrift(3.0)
+, _soilMoistureDrift(150)
+, _illuminanceDrift(0)
+, _reserve(3 * AGRUMINO_CODEC_MAX_SIZE)
+{
+}
+
+// Hours of buffering: at least minHours before a push for a change in the
+// readings, at most maxHours in any case
+void AgruminoFlushPolicy::setHours(int minHours, int maxHours) {
+  _minHours = minHours;
+  _maxHours = maxHours;
+}
+
+// At or below level (%) and without USB only a full buffer or maxHours of
+// buffering cause a push
+void AgruminoFlushPolicy::setLowBattery(unsigned int level, int maxHours) {
+  _lowBatteryLevel = level;
+  _lowBatteryHours = maxHours;
+}
+
+// Changes from the first buffered sample that are worth a push: temperature
+// in °C, raw soil moisture, illuminance in percent of the first reading.
+// 0 ignores the field (the default for the illuminance, that follows the day)
+void AgruminoFlushPolicy::setDrift(float temperature, float soilMoisture, float illuminancePercent) {
+  _temperatureDrift = temperature;
+  _soilMoistureDrift = soilMoisture;
+  _illuminanceDrift = illuminancePercent;
+}
+
+// Free bytes under which the buffer is pushed: leave room for the samples
+// stored while the uploads fail
+void AgruminoFlushPolicy::setReserve(int bytes) {
+  _reserve = bytes;
+}
+
+// firstBuffered is the oldest sample not pushed yet (NULL if the buffer is
+// empty), freeMemory and hours the ones of the Agrumino memory.
+uint8_t AgruminoFlushPolicy::decide(const AgruminoSample &sample, const AgruminoSample *firstBuffered, int freeMemory, int hours) {
+  if (!firstBuffered)
+    return AGRUMINO_FLUSH_NONE;
+
+  uint8_t reasons = AGRUMINO_FLUSH_NONE;
+  bool lowBattery = !sample.isAttachedToUSB && sample.batteryLevel <= _lowBatteryLevel;
+  if (freeMemory < _reserve)
+    reasons |= AGRUMINO_FLUSH_FULL;
+  if (sample.isAttachedToUSB)
+    reasons |= AGRUMINO_FLUSH_USB;
+  if (hours >= (lowBattery ? _lowBatteryHours : _maxHours))
+    reasons |= AGRUMINO_FLUSH_AGE;
+  if (!lowBattery && hours >= _minHours && drifted(sample, *firstBuffered))
+    reasons |= AGRUMINO_FLUSH_CHANGE;
+  return reasons;
+}
+
+// For the samples stored with appendRecord(): the first buffered sample is
+// read in place from the memory, or from the staged ones if the memory is
+// empty. The staged samples will take their room in the memory too.
+uint8_t AgruminoFlushPolicy::decide(Agrumino &agrumino, const AgruminoSample &sample) {
+  AgruminoRecordSpan<AgruminoSample> samples = agrumino.getRecords<AgruminoSample>();
+  AgruminoSample staged;
+  const AgruminoSample *first = NULL;
+  if (!samples.empty())
+    first = &samples[0];
+  else if (agrumino.readStaged(0, staged))
+    first = &staged;
+  int freeMemory = agrumino.getFreeMemory() - agrumino.getStagedCount() * (int) sizeof(AgruminoSample);
+  return decide(sample, first, freeMemory, agrumino.getHours());
+}
+
+// Name of the strongest reason, for the logs
+const char *AgruminoFlushPolicy::reasonName(uint8_t reasons) {
+  if (reasons & AGRUMINO_FLUSH_FULL)
+    return "memory full";
+  if (reasons & AGRUMINO_FLUSH_USB)
+    return "USB power";
+  if (reasons & AGRUMINO_FLUSH_AGE)
+    return "max hours";
+  if (reasons & AGRUMINO_FLUSH_CHANGE)
+    return "readings changed";
+  return "none";
+}
+
+bool AgruminoFlushPolicy::drifted(const AgruminoSample &sample, const AgruminoSample &reference) {
+  float lux = reference.illuminance > FLUSH_MIN_LUX ? reference.illuminance : FLUSH_MIN_LUX;
+  return (_temperatureDrift > 0 && fabs(sample.temperature - reference.temperature) >= _temperatureDrift)
+      || (_soilMoistureDrift > 0 && fabs(sample.soilMoisture - reference.soilMoisture) >= _soilMoistureDrift)
+      || (_illuminanceDrift > 0 && fabs(sample.illuminance - reference.illuminance) * 100 >= _illuminanceDrift * lux);
+}
@@ -0,0 +1,66 @@
+/*
+  AgruminoFlushPolicy.h - Decides at every wake-up whether to keep buffering
+  the samples in flash or to upload them
+  Created for the AgruminoFlash project.
+
+  Turning the radio on is the largest cost of a wake-up, so the buffer should
+  be pushed as rarely as possible, but never so late that it fills up and a
+  sample is lost. decide() weighs, after the sample of the wake-up has been
+  stored:
+    - the free memory: below the reserve the buffer is pushed (FULL)
+    - the USB power: data is pushed at every wake-up (USB)
+    - the age of the buffer: pushed after maxHours, or after lowBatteryHours
+      when the battery is low (AGE)
+    - the drift of the readings from the first buffered sample: pushed after
+      minHours if temperature, soil moisture or light changed enough (CHANGE),
+      unless the battery is low
+  The result is a mask of the reasons, AGRUMINO_FLUSH_NONE to keep buffering.
+
+  Example:
+    AgruminoFlushPolicy flushPolicy;
+    flushPolicy.setHours(1, 12);
+    agrumino.appendRecord(sample);
+    agrumino.incrHours();
+    if (flushPolicy.decide(agrumino, sample))
+      upload();
+*/
+
+#ifndef AgruminoFlushPolicy_h
+#define AgruminoFlushPolicy_h
+
+#include "Agrumino.h"
+
+#define AGRUMINO_FLUSH_NONE     0x00
+#define AGRUMINO_FLUSH_FULL     0x01 // Free memory below the reserve
+#define AGRUMINO_FLUSH_USB      0x02 // Powered by USB
+#define AGRUMINO_FLUSH_AGE      0x04 // Buffer older than the max hours
+#define AGRUMINO_FLUSH_CHANGE   0x08 // Readings drifted from the first buffered sample
+
+class AgruminoFlushPolicy {
+public:
+  AgruminoFlushPolicy();
+
+  void setHours(int minHours, int maxHours);
+  void setLowBattery(unsigned int level, int maxHours);
+  void setDrift(float temperature, float soilMoisture, float illuminancePercent);
+  void setReserve(int bytes);
+
+  uint8_t decide(const AgruminoSample &sample, const AgruminoSample *firstBuffered, int freeMemory, int hours);
+  uint8_t decide(Agrumino &agrumino, const AgruminoSample &sample);
+
+  static const char *reasonName(uint8_t reasons);
+
+protected:
+  bool drifted(const AgruminoSample &sample, const AgruminoSample &reference);
+
+  int _minHours;
+  int _maxHours;
+  unsigned int _lowBatteryLevel;
+  int _lowBatteryHours;
+  float _temperatureDrift;
+  float _soilMoistureDrift;
+  float _illuminanceDrift; // Percent of the first buffered reading
+  int _reserve;
+};
+
+#endif
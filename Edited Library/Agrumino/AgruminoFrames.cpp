@@ -0,0 +1,99 @@
+/*
+  AgruminoFrames.cpp - Binary upload of the buffered records in CRC'd frames
+  For details @see AgruminoFrames.h
+*/
+
+#include "AgruminoFrames.h"
+#include "AgruminoHttp.h"
+#include "EEPROM.h"
+
+AgruminoFrames::AgruminoFrames(const char *host, uint16_t port, const char *path)
+: _host(host)
+, _port(port)
+, _path(path)
+, _generation(0)
+, _clock(0)
+, _status(0)
+, _serverTime(0)
+{
+}
+
+// Generation of the memory the records come from, written in every frame
+void AgruminoFrames::setGeneration(uint16_t generation) {
+  _generation = generation;
+}
+
+// Device clock now, written in every frame
+void AgruminoFrames::setClock(uint32_t time) {
+  _clock = time;
+}
+
+// Bytes of the frames holding count records
+size_t AgruminoFrames::length(size_t count, uint16_t recordSize) {
+  size_t frames = (count + AGRUMINO_FRAME_MAX_RECORDS - 1) / AGRUMINO_FRAME_MAX_RECORDS;
+  return frames * (AGRUMINO_FRAME_HEADER_SIZE + AGRUMINO_FRAME_CRC_SIZE) + count * recordSize;
+}
+
+// Sends the records in a single POST on the client connection (left open for
+// the caller). Returns true if the receiver accepted them (2xx).
+bool AgruminoFrames::upload(Client &client, const uint8_t *records, size_t count, uint16_t recordSize, uint8_t type) {
+  _status = 0;
+  _serverTime = 0;
+  if (!count)
+    return true;
+  if (!records || !recordSize || !connect(client))
+    return false;
+
+  client.print("POST ");
+  client.print(_path);
+  client.print(" HTTP/1.1\r\nHost: ");
+  client.print(_host);
+  client.print("\r\nContent-Type: application/octet-stream\r\nConnection: keep-alive\r\nContent-Length: ");
+  client.print((unsigned long) length(count, recordSize));
+  client.print("\r\n\r\n");
+  if (write(client, records, count, recordSize, type) != length(count, recordSize))
+    return false;
+  return AgruminoHttp::readReply(client, _status, AGRUMINO_FRAME_TIMEOUT_MS, &_serverTime) && _status >= 200 && _status < 300;
+}
+
+// Writes the records as frames. The payload goes straight from records to
+// out, only the headers and the CRCs are built here. Returns the bytes written.
+size_t AgruminoFrames::write(Print &out, const uint8_t *records, size_t count, uint16_t recordSize, uint8_t type) {
+  uint32_t device = ESP.getChipId();
+  size_t written = 0;
+  for (size_t first = 0; first < count; first += AGRUMINO_FRAME_MAX_RECORDS) {
+    uint16_t frameCount = count - first < AGRUMINO_FRAME_MAX_RECORDS ? count - first : AGRUMINO_FRAME_MAX_RECORDS;
+    uint8_t header[AGRUMINO_FRAME_HEADER_SIZE] = {
+      (uint8_t) AGRUMINO_FRAME_MAGIC, (uint8_t) (AGRUMINO_FRAME_MAGIC >> 8),
+      (uint8_t) (AGRUMINO_FRAME_MAGIC >> 16), (uint8_t) (AGRUMINO_FRAME_MAGIC >> 24),
+      AGRUMINO_FRAME_VERSION, type,
+      (uint8_t) recordSize, (uint8_t) (recordSize >> 8),
+      (uint8_t) frameCount, (uint8_t) (frameCount >> 8),
+      (uint8_t) device, (uint8_t) (device >> 8), (uint8_t) (device >> 16), (uint8_t) (device >> 24),
+      (uint8_t) _generation, (uint8_t) (_generation >> 8),
+      (uint8_t) first, (uint8_t) (first >> 8),
+      (uint8_t) _clock, (uint8_t) (_clock >> 8), (uint8_t) (_clock >> 16), (uint8_t) (_clock >> 24)
+    };
+    const uint8_t *payload = records + first * recordSize;
+    size_t payloadSize = (size_t) frameCount * recordSize;
+    uint32_t crc = EEPROMClass::crc32(header, sizeof(header));
+    crc = EEPROMClass::crc32(payload, payloadSize, crc);
+    uint8_t trailer[AGRUMINO_FRAME_CRC_SIZE] = {(uint8_t) crc, (uint8_t) (crc >> 8), (uint8_t) (crc >> 16), (uint8_t) (crc >> 24)};
+
+    written += out.write(header, sizeof(header));
+    written += out.write(payload, payloadSize);
+    written += out.write(trailer, sizeof(trailer));
+  }
+  return written;
+}
+
+bool AgruminoFrames::connect(Client &client) {
+  if (client.connected())
+    return true;
+  for (uint8_t i = 0; i < 3; i++) {
+    if (client.connect(_host, _port))
+      return true;
+    delay(500);
+  }
+  return false;
+}
@@ -0,0 +1,86 @@
+/*
+  AgruminoFrames.h - Binary upload of the buffered records in CRC'd frames
+  Created for the AgruminoFlash project.
+
+  As text (field1=22.50&field2=...) a sample costs about four times its 24
+  bytes on air. AgruminoFrames sends the records as they are in the flash
+  buffer (see Agrumino::getRecords()), packed in frames, in the body of a
+  single HTTP POST (Content-Type: application/octet-stream).
+
+  Frame layout (little endian):
+    [magic "AGRF"][version][type][record size][count]  4+1+1+2+2 bytes
+    [device][generation][first][clock]                 4+2+2+4 bytes
+    [count * record size bytes of records]
+    [CRC-32 of all the bytes above]                    4 bytes
+  The payload length is count * record size. device is the chip ID,
+  generation the one of the memory (Agrumino::getGeneration()) and first the
+  index of the first record of the frame in the upload: together they let
+  the receiver drop a batch uploaded twice. clock is the device clock at the
+  upload (Agrumino::getTime()): the receiver dates a sample at its own time
+  less clock - sample.time. type tells how to decode the records:
+  AGRUMINO_FRAME_SAMPLE for AgruminoSample, AGRUMINO_FRAME_RAW for any other
+  record. Version 1 frames had no clock.
+
+  extras/receiver/agrumino_receiver.py is a reference receiver: it decodes
+  the frames into CSV or JSON.
+
+  Example:
+    WiFiClient client;
+    AgruminoFrames frames("192.168.1.10", 8080);
+    frames.setGeneration(agrumino.getGeneration());
+    frames.setClock(agrumino.getTime());
+    if (frames.upload(client, agrumino.getRecords<AgruminoSample>()))
+      agrumino.discardMemory();
+*/
+
+#ifndef AgruminoFrames_h
+#define AgruminoFrames_h
+
+#include "Arduino.h"
+#include "Client.h"
+#include "AgruminoRecord.h"
+
+#define AGRUMINO_FRAME_MAGIC         0x46524741 // "AGRF"
+#define AGRUMINO_FRAME_VERSION       2
+#define AGRUMINO_FRAME_HEADER_SIZE   22
+#define AGRUMINO_FRAME_CRC_SIZE      4
+#define AGRUMINO_FRAME_MAX_RECORDS   64   // Records per frame: a lost frame costs at most these
+#define AGRUMINO_FRAME_TIMEOUT_MS    5000 // Wait for the reply of the receiver
+
+#define AGRUMINO_FRAME_RAW           0
+#define AGRUMINO_FRAME_SAMPLE        1
+
+class AgruminoFrames {
+public:
+  AgruminoFrames(const char *host, uint16_t port = 80, const char *path = "/agrumino");
+
+  void setGeneration(uint16_t generation);
+  void setClock(uint32_t time);
+
+  bool upload(Client &client, AgruminoRecordSpan<AgruminoSample> samples) {
+    return upload(client, (const uint8_t *) samples.begin(), samples.size(), sizeof(AgruminoSample), AGRUMINO_FRAME_SAMPLE);
+  }
+  template<typename T> bool upload(Client &client, AgruminoRecordSpan<T> records) {
+    return upload(client, (const uint8_t *) records.begin(), records.size(), sizeof(T), AGRUMINO_FRAME_RAW);
+  }
+  bool upload(Client &client, const uint8_t *records, size_t count, uint16_t recordSize, uint8_t type);
+
+  size_t write(Print &out, const uint8_t *records, size_t count, uint16_t recordSize, uint8_t type);
+  static size_t length(size_t count, uint16_t recordSize);
+
+  int getStatus() {return _status;} // HTTP status of the last upload, 0 if no reply
+  uint32_t getServerTime() {return _serverTime;} // Date of the reply (unix time), 0 if none
+
+protected:
+  bool connect(Client &client);
+
+  const char *_host;
+  uint16_t _port;
+  const char *_path;
+  uint16_t _generation;
+  uint32_t _clock;
+  int _status;
+  uint32_t _serverTime;
+};
+
+#endif
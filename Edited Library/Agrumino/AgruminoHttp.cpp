@@ -0,0 +1,115 @@
+/*
+  AgruminoHttp.cpp - Minimal HTTP/1.1 reply reader for the Agrumino uploaders
+  For details @see AgruminoHttp.h
+*/
+
+#include "AgruminoHttp.h"
+
+// Reads the status line and the headers, then skips the body, so the
+// connection can carry the next request. Returns false on timeout or if the
+// reply isn't HTTP; status is the code of the reply (e.g. 202), 0 if none,
+// and date (if not NULL) its Date, 0 if none.
+bool AgruminoHttp::readReply(Client &client, int &status, unsigned long timeout, uint32_t *date) {
+  unsigned long deadline = millis() + timeout;
+  status = 0;
+  if (date)
+    *date = 0;
+  char line[64];
+  if (readLine(client, line, sizeof(line), deadline) < 0)
+    return false;
+  if (strncmp(line, "HTTP/1.", 7) || strlen(line) < 12)
+    return false;
+  status = atoi(line + 9);
+
+  long contentLength = -1;
+  bool chunked = false;
+  int length;
+  while ((length = readLine(client, line, sizeof(line), deadline)) > 0) {
+    if (!strncasecmp(line, "Content-Length:", 15))
+      contentLength = atol(line + 15);
+    else if (!strncasecmp(line, "Transfer-Encoding:", 18) && strstr(line + 18, "chunked"))
+      chunked = true;
+    else if (date && !strncasecmp(line, "Date:", 5))
+      *date = parseDate(line + 5);
+  }
+  if (length < 0)
+    return false;
+
+  if (chunked) {
+    // [size in hex] CRLF [data] CRLF ... until a chunk of size 0 and an empty line
+    long size;
+    do {
+      if (readLine(client, line, sizeof(line), deadline) < 0)
+        return false;
+      size = strtol(line, NULL, 16);
+      if (!skip(client, size, deadline) || readLine(client, line, sizeof(line), deadline) < 0)
+        return false;
+    } while (size > 0);
+  } else if (contentLength > 0 && !skip(client, contentLength, deadline)) {
+    return false;
+  }
+  return true;
+}
+
+// Unix time of a HTTP date ("Sun, 06 Nov 1994 08:49:37 GMT"), 0 if it isn't one
+uint32_t AgruminoHttp::parseDate(const char *value) {
+  static const char months[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
+  int day, year, hour, minute, second;
+  char month[4];
+  if (sscanf(value, " %*3s, %2d %3s %4d %2d:%2d:%2d", &day, month, &year, &hour, &minute, &second) != 6)
+    return 0;
+  const char *found = strstr(months, month);
+  if (strlen(month) != 3 || !found || (found - months) % 3 || year < 1970 || day < 1 || day > 31 || hour > 23 || minute > 59 || second > 60)
+    return 0;
+
+  // Days from 1970-01-01 of a date of the proleptic Gregorian calendar, the year starting in March
+  int m = (found - months) / 3 + 1;
+  int y = m <= 2 ? year - 1 : year;
+  int era = y / 400;
+  int yearOfEra = y - era * 400;
+  int dayOfYear = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + day - 1;
+  int dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+  long days = era * 146097L + dayOfEra - 719468L;
+  return (uint32_t) days * 86400UL + hour * 3600UL + minute * 60UL + second;
+}
+
+// Drops size bytes of the reply
+bool AgruminoHttp::skip(Client &client, long size, unsigned long deadline) {
+  uint8_t buffer[32];
+  while (size > 0) {
+    if ((long) (deadline - millis()) <= 0)
+      return false;
+    if (!client.available()) {
+      if (!client.connected())
+        return false;
+      delay(1);
+      continue;
+    }
+    int read = client.read(buffer, size < (long) sizeof(buffer) ? size : sizeof(buffer));
+    if (read > 0)
+      size -= read;
+  }
+  return true;
+}
+
+// Reads a line without its CRLF (truncated to size - 1). Returns its length,
+// -1 on timeout or if the connection is closed.
+int AgruminoHttp::readLine(Client &client, char *line, size_t size, unsigned long deadline) {
+  size_t length = 0;
+  while ((long) (deadline - millis()) > 0) {
+    if (!client.available()) {
+      if (!client.connected())
+        return -1;
+      delay(1);
+      continue;
+    }
+    int c = client.read();
+    if (c == '\n') {
+      line[length] = 0;
+      return length;
+    }
+    if (c != '\r' && c >= 0 && length < size - 1)
+      line[length++] = c;
+  }
+  return -1;
+}
@@ -0,0 +1,30 @@
+/*
+  AgruminoHttp.h - Minimal HTTP/1.1 reply reader for the Agrumino uploaders
+  Created for the AgruminoFlash project.
+
+  The uploaders write their requests straight to a Client and keep the
+  connection alive between requests, so a reply must be consumed to its
+  end (Content-Length or chunked body) before the next request. Nothing is
+  buffered: the headers are read one short line at a time and the body is
+  dropped. The Date header of the reply is kept, as unix time: the board
+  has no clock of its own and the server time anchors the one of the
+  samples (see AgruminoClock.h).
+*/
+
+#ifndef AgruminoHttp_h
+#define AgruminoHttp_h
+
+#include "Arduino.h"
+#include "Client.h"
+
+class AgruminoHttp {
+public:
+  static bool readReply(Client &client, int &status, unsigned long timeout, uint32_t *date = NULL);
+  static uint32_t parseDate(const char *value);
+
+protected:
+  static bool skip(Client &client, long size, unsigned long deadline);
+  static int readLine(Client &client, char *line, size_t size, unsigned long deadline);
+};
+
+#endif
@@ -0,0 +1,193 @@
+/*
+  AgruminoJson.cpp - Streaming JSON writer for the Agrumino uploads
+  For details @see AgruminoJson.h
+*/
+
+#include "AgruminoJson.h"
+
+// Counts the bytes of the document, writes nothing
+AgruminoJson::AgruminoJson()
+: _out(NULL)
+, _used(0)
+, _length(0)
+, _started(0)
+, _depth(0)
+, _afterKey(false)
+, _failed(false)
+{
+}
+
+AgruminoJson::AgruminoJson(Print &out)
+: _out(&out)
+, _used(0)
+, _length(0)
+, _started(0)
+, _depth(0)
+, _afterKey(false)
+, _failed(false)
+{
+}
+
+AgruminoJson::~AgruminoJson() {
+  flush();
+}
+
+void AgruminoJson::beginObject() {
+  separator();
+  write('{');
+  push();
+}
+
+void AgruminoJson::endObject() {
+  pop();
+  write('}');
+}
+
+void AgruminoJson::beginArray() {
+  separator();
+  write('[');
+  push();
+}
+
+void AgruminoJson::endArray() {
+  pop();
+  write(']');
+}
+
+void AgruminoJson::key(const char *name) {
+  value(name);
+  write(':');
+  _afterKey = true;
+}
+
+// Writes a string, escaping quotes, backslashes and control characters
+void AgruminoJson::value(const char *text) {
+  separator();
+  write('"');
+  for (const char *c = text ? text : ""; *c; c++) {
+    if (*c == '"' || *c == '\\') {
+      write('\\');
+      write(*c);
+    } else if ((uint8_t) *c < 0x20) {
+      char escape[7];
+      snprintf(escape, sizeof(escape), "\\u%04x", (uint8_t) *c);
+      write(escape, 6);
+    } else {
+      write(*c);
+    }
+  }
+  write('"');
+}
+
+// 21 bytes: a long is 64 bits on the host build (extras/host)
+void AgruminoJson::value(long number) {
+  char text[21];
+  separator();
+  write(text, snprintf(text, sizeof(text), "%ld", number));
+}
+
+void AgruminoJson::value(unsigned long number) {
+  char text[21];
+  separator();
+  write(text, snprintf(text, sizeof(text), "%lu", number));
+}
+
+// NaN and infinities aren't valid JSON: they're written as null
+void AgruminoJson::value(double number, uint8_t decimals) {
+  if (isnan(number) || isinf(number)) {
+    null();
+    return;
+  }
+  char text[24];
+  int size = snprintf(text, sizeof(text), "%.*f", decimals > 9 ? 9 : decimals, number);
+  separator();
+  write(text, size < (int) sizeof(text) ? size : sizeof(text) - 1);
+}
+
+void AgruminoJson::value(bool flag) {
+  separator();
+  write(flag ? "true" : "false");
+}
+
+void AgruminoJson::null() {
+  separator();
+  write("null");
+}
+
+// Writes an already formatted value
+void AgruminoJson::raw(const char *json) {
+  separator();
+  write(json);
+}
+
+// The fields of the sample as an object, with the names used by the sketches
+void AgruminoJson::sample(const AgruminoSample &sample) {
+  beginObject();
+  member("temp", sample.temperature, 2);
+  member("soil", sample.soilMoisture, 0);
+  member("lux", sample.illuminance, 0);
+  member("battVolt", sample.batteryVoltage, 3);
+  member("battLevel", (unsigned int) sample.batteryLevel);
+  member("battCharging", sample.isBatteryCharging);
+  member("usbConnected", sample.isAttachedToUSB);
+  member("button", sample.isButtonPressed);
+  member("time", (unsigned long) sample.time);
+  endObject();
+}
+
+// Writes the buffered bytes to the Print. Returns false if some were lost
+bool AgruminoJson::flush() {
+  if (_out && _used) {
+    if (_out->write((const uint8_t *) _buffer, _used) != _used)
+      _failed = true;
+    _used = 0;
+  }
+  return !_failed;
+}
+
+// Comma before the elements after the first one, nothing after a key
+void AgruminoJson::separator() {
+  if (_afterKey) {
+    _afterKey = false;
+    return;
+  }
+  if (_depth == 0 || _depth > AGRUMINO_JSON_MAX_DEPTH)
+    return;
+  uint32_t bit = 1UL << (_depth - 1);
+  if (_started & bit)
+    write(',');
+  _started |= bit;
+}
+
+void AgruminoJson::push() {
+  _depth++;
+  if (_depth <= AGRUMINO_JSON_MAX_DEPTH)
+    _started &= ~(1UL << (_depth - 1));
+}
+
+void AgruminoJson::pop() {
+  if (_depth > 0)
+    _depth--;
+  _afterKey = false;
+}
+
+void AgruminoJson::write(const char *text, size_t size) {
+  _length += size;
+  if (!_out)
+    return;
+  while (size > 0) {
+    size_t chunk = sizeof(_buffer) - _used;
+    if (chunk > size)
+      chunk = size;
+    memcpy(_buffer + _used, text, chunk);
+    _used += chunk;
+    text += chunk;
+    size -= chunk;
+    if (_used == sizeof(_buffer))
+      flush();
+  }
+}
+
+void AgruminoJson::write(char c) {
+  write(&c, 1);
+}
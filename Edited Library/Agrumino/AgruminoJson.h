@@ -0,0 +1,98 @@
+/*
+  AgruminoJson.h - Streaming JSON writer for the Agrumino uploads
+  Created for the AgruminoFlash project.
+
+  Building a payload with a StaticJsonBuffer, printTo(String) and String
+  concatenations needs the whole document in RAM, and the heap of the
+  ESP8266 (~40 KB) fragments after a few of them: the number of samples in
+  a request is capped by the memory. AgruminoJson writes the document
+  straight to a Print (e.g. a WiFiClient) through a small fixed buffer, so
+  any number of records is sent in constant memory.
+
+  HTTP needs the Content-Length before the body. A writer without a Print
+  only counts the bytes: the same code is run twice, first to count and
+  then to send.
+
+  Example:
+    void writeBody(AgruminoJson &json) {
+      json.beginArray();
+      for (const AgruminoSample &sample : agrumino.getRecords<AgruminoSample>())
+        json.sample(sample);
+      json.endArray();
+    }
+
+    AgruminoJson counter;
+    writeBody(counter);
+    client.print("Content-Length: ");
+    client.println((unsigned long) counter.length());
+    client.println();
+    AgruminoJson json(client);
+    writeBody(json);
+    json.flush();
+*/
+
+#ifndef AgruminoJson_h
+#define AgruminoJson_h
+
+#include "Arduino.h"
+#include "AgruminoRecord.h"
+
+#define AGRUMINO_JSON_CHUNK       64 // Bytes written to the Print at a time
+#define AGRUMINO_JSON_MAX_DEPTH   32 // Nested objects and arrays
+
+class AgruminoJson {
+public:
+  AgruminoJson();
+  AgruminoJson(Print &out);
+  ~AgruminoJson();
+
+  void beginObject();
+  void endObject();
+  void beginArray();
+  void endArray();
+  void key(const char *name);
+
+  void value(const char *text);
+  void value(long number);
+  void value(unsigned long number);
+  void value(int number) {value((long) number);}
+  void value(unsigned int number) {value((unsigned long) number);}
+  void value(double number, uint8_t decimals = 2);
+  void value(bool flag);
+  void null();
+  void raw(const char *json);
+
+  template<typename T> void member(const char *name, T data) {
+    key(name);
+    value(data);
+  }
+  void member(const char *name, double number, uint8_t decimals) {
+    key(name);
+    value(number, decimals);
+  }
+
+  void sample(const AgruminoSample &sample);
+
+  bool flush();
+  size_t length() {return _length;} // Bytes of the document so far, written or only counted
+  bool failed() {return _failed;}   // The Print didn't take some bytes
+
+protected:
+  void separator();
+  void push();
+  void pop();
+  void write(const char *text, size_t size);
+  void write(const char *text) {write(text, strlen(text));}
+  void write(char c);
+
+  Print *_out;
+  char _buffer[AGRUMINO_JSON_CHUNK];
+  size_t _used;
+  size_t _length;
+  uint32_t _started; // Bit n: the container at depth n already has an element
+  uint8_t _depth;
+  bool _afterKey;
+  bool _failed;
+};
+
+#endif
@@ -0,0 +1,74 @@
+/*
+  AgruminoRecord.h - Typed records for the Agrumino flash storage
+  Created for the AgruminoFlash project.
+
+  A record is a plain struct declared with AGRUMINO_RECORD: the compiler
+  lays the fields out one after the other (no padding), so the flash layout
+  is the struct itself and no address has to be computed by hand. Records
+  are written and read whole with Agrumino::appendRecord() and
+  Agrumino::readRecord(), a single memcpy each.
+
+  Example:
+    struct AGRUMINO_RECORD MySample {
+      float temperature;
+      uint16_t soil;
+    };
+    agrumino.appendRecord(mySample);
+
+  The stored records can also be read in place, without any copy, through
+  Agrumino::getRecords(): an AgruminoRecordSpan over the RAM copy of the
+  flash. Packed records have no alignment requirement, so they can be
+  accessed at any address:
+    for (const MySample &sample : agrumino.getRecords<MySample>())
+      upload(sample.temperature);
+*/
+
+#ifndef AgruminoRecord_h
+#define AgruminoRecord_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define AGRUMINO_RECORD __attribute__((packed))
+
+// The sample stored by the flash sketches. The first 20 bytes have the
+// layout of the sequence boolWrite x3, floatWrite x4, intWrite used before,
+// the time of the reading follows.
+struct AGRUMINO_RECORD AgruminoSample {
+  bool isAttachedToUSB;
+  bool isBatteryCharging;
+  bool isButtonPressed;
+  float temperature;
+  float soilMoisture;
+  float illuminance;
+  float batteryVoltage;
+  uint8_t batteryLevel;
+  uint32_t time;      // Device clock (Agrumino::getTime()), unix time with Agrumino::getEpoch()
+};
+
+static_assert(sizeof(AgruminoSample) == 24, "AgruminoSample layout changed");
+
+// Read-only view of consecutive records. Valid until the next write to the
+// memory (a write can move the records, see Agrumino::getData()).
+template<typename T> class AgruminoRecordSpan {
+public:
+  static_assert(alignof(T) == 1, "Declare the record with AGRUMINO_RECORD");
+
+  AgruminoRecordSpan(const uint8_t *data = 0, size_t size = 0)
+  : _data((const T *) data)
+  , _count(data ? size / sizeof(T) : 0)
+  {
+  }
+
+  const T *begin() const {return _data;}
+  const T *end() const {return _data + _count;}
+  const T &operator[](size_t index) const {return _data[index];}
+  size_t size() const {return _count;}
+  bool empty() const {return _count == 0;}
+
+protected:
+  const T *_data;
+  size_t _count;
+};
+
+#endif
@@ -0,0 +1,110 @@
+/*
+  AgruminoStaging.cpp - Staging buffer of records in the ESP8266 RTC memory
+  For details @see AgruminoStaging.h
+*/
+
+#include "Arduino.h"
+#include "AgruminoStaging.h"
+#include "EEPROM.h"
+
+#define STAGING_MAGIC 0x47545341 // "ASTG"
+
+static_assert(AGRUMINO_STAGING_HEADER_SIZE == 16, "AgruminoStaging header layout changed");
+
+AgruminoStaging::AgruminoStaging()
+: _capacity(0)
+{
+  memset(_words, 0, sizeof(_words));
+}
+
+// Loads the buffer from the RTC memory. A buffer that isn't valid (power
+// loss) or was written with another record size starts empty.
+bool AgruminoStaging::begin(size_t recordSize) {
+  if (recordSize == 0 || recordSize > AGRUMINO_STAGING_SIZE - AGRUMINO_STAGING_HEADER_SIZE) {
+    _capacity = 0;
+    return false;
+  }
+  _capacity = (AGRUMINO_STAGING_SIZE - AGRUMINO_STAGING_HEADER_SIZE) / recordSize;
+
+  if (ESP.rtcUserMemoryRead(AGRUMINO_STAGING_BLOCK, _words, sizeof(_words))
+      && _header.magic == STAGING_MAGIC && _header.recordSize == recordSize
+      && _header.count <= _capacity && _header.crc == checksum())
+    return true;
+
+  _header.recordSize = recordSize;
+  _header.hours = 0;
+  clear();
+  return true;
+}
+
+// Adds a record. Returns false if the buffer is full
+bool AgruminoStaging::push(const void *record) {
+  if (full())
+    return false;
+  size_t offset = AGRUMINO_STAGING_HEADER_SIZE + _header.count * _header.recordSize;
+  memcpy((uint8_t *) _words + offset, record, _header.recordSize);
+  _header.count++;
+  return save(offset, _header.recordSize);
+}
+
+bool AgruminoStaging::read(uint8_t index, void *record) {
+  if (index >= _header.count)
+    return false;
+  memcpy(record, (uint8_t *) _words + AGRUMINO_STAGING_HEADER_SIZE + index * _header.recordSize, _header.recordSize);
+  return true;
+}
+
+// Removes the count oldest records (e.g. the ones spilled to the flash)
+bool AgruminoStaging::drop(uint8_t count) {
+  if (count >= _header.count) {
+    clear();
+    return true;
+  }
+  uint8_t *records = (uint8_t *) _words + AGRUMINO_STAGING_HEADER_SIZE;
+  _header.count -= count;
+  memmove(records, records + count * _header.recordSize, _header.count * _header.recordSize);
+  return save(AGRUMINO_STAGING_HEADER_SIZE, _header.count * _header.recordSize);
+}
+
+// Drops every record, the hours are kept
+void AgruminoStaging::clear() {
+  _header.magic = STAGING_MAGIC;
+  _header.count = 0;
+  _header.reserved = 0;
+  _header.reserved2 = 0;
+  _header.reserved3 = 0;
+  save(0, 0);
+}
+
+void AgruminoStaging::addHour() {
+  if (!_capacity)
+    return;
+  _header.hours++;
+  save(0, 0);
+}
+
+void AgruminoStaging::clearHours() {
+  if (!_capacity)
+    return;
+  _header.hours = 0;
+  save(0, 0);
+}
+
+// CRC of the header after the CRC field and of the records
+uint32_t AgruminoStaging::checksum() {
+  const uint8_t *data = (const uint8_t *) _words;
+  return EEPROMClass::crc32(data + 8, AGRUMINO_STAGING_HEADER_SIZE - 8 + _header.count * _header.recordSize);
+}
+
+// Writes the header and the bytes [offset, offset + size) of the area. The
+// RTC memory is written in 4 bytes blocks: the range is widened to them.
+bool AgruminoStaging::save(size_t offset, size_t size) {
+  _header.crc = checksum();
+  bool ok = ESP.rtcUserMemoryWrite(AGRUMINO_STAGING_BLOCK, _words, AGRUMINO_STAGING_HEADER_SIZE);
+  if (size > 0) {
+    size_t first = offset / 4;
+    size_t last = (offset + size + 3) / 4;
+    ok = ESP.rtcUserMemoryWrite(AGRUMINO_STAGING_BLOCK + first, _words + first, (last - first) * 4) && ok;
+  }
+  return ok;
+}
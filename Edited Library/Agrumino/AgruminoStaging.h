@@ -0,0 +1,73 @@
+/*
+  AgruminoStaging.h - Staging buffer of records in the ESP8266 RTC memory
+  Created for the AgruminoFlash project.
+
+  The RTC user memory (512 bytes) survives deep sleep and is written in a
+  few microseconds, with no erase. AgruminoStaging keeps there the records
+  of the last wake-ups, so most of the wake-ups don't touch the flash at
+  all: the records are spilled to the flash, all in a single commit, when
+  the buffer is full or before an upload (see Agrumino::enableStaging()).
+
+  Layout, from block AGRUMINO_STAGING_BLOCK (the first 128 bytes are left to
+  the OTA boot loader, that keeps its commands there, the next 8 to the wake
+  state of Agrumino, 28 to the WiFi cache of AgruminoWiFi.h and 28 to the
+  clock of AgruminoClock.h):
+    [magic][CRC-32][record size][count][-][hours][-]  4+4+2+1+1+2+2+4 bytes
+    [records...]
+  The CRC covers the header (but the CRC itself) and the records: the RTC
+  memory is random after a power loss, and then the buffer starts empty.
+  A power loss (not a deep sleep) drops the staged records.
+*/
+
+#ifndef AgruminoStaging_h
+#define AgruminoStaging_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define AGRUMINO_STAGING_BLOCK         48  // First 4 bytes block of the RTC user memory used
+#define AGRUMINO_STAGING_SIZE         320  // Bytes from AGRUMINO_STAGING_BLOCK to the end of the RTC user memory
+#define AGRUMINO_STAGING_HEADER_SIZE   16
+
+class AgruminoStaging {
+public:
+  AgruminoStaging();
+
+  bool begin(size_t recordSize);
+  bool push(const void *record);
+  bool read(uint8_t index, void *record);
+  bool drop(uint8_t count);
+  void clear();
+
+  void addHour();
+  uint16_t hours() {return _header.hours;} // Hours counted while staging, not yet in the flash registers
+  void clearHours();
+
+  uint8_t count() {return _header.count;}
+  uint8_t capacity() {return _capacity;}
+  bool full() {return _header.count >= _capacity;}
+  size_t recordSize() {return _header.recordSize;}
+
+protected:
+  struct Header {
+    uint32_t magic;
+    uint32_t crc;
+    uint16_t recordSize;
+    uint8_t count;
+    uint8_t reserved;
+    uint16_t hours;
+    uint16_t reserved2;
+    uint32_t reserved3;
+  };
+
+  uint32_t checksum();
+  bool save(size_t offset, size_t size);
+
+  union {
+    Header _header;
+    uint32_t _words[AGRUMINO_STAGING_SIZE / 4]; // RAM copy of the whole area
+  };
+  uint8_t _capacity;
+};
+
+#endif
@@ -0,0 +1,147 @@
+/*
+  AgruminoThingSpeak.cpp - Bulk upload of the buffered samples to ThingSpeak
+  For details @see AgruminoThingSpeak.h
+*/
+
+#include "AgruminoThingSpeak.h"
+
+// "2018-03-01 10:00:00 +0000" of a unix time
+static void formatTime(uint32_t time, char *out, size_t size) {
+  // Date of the proleptic Gregorian calendar from the days since 1970-01-01, the year starting in March
+  long days = time / 86400 + 719468L;
+  long era = days / 146097;
+  long dayOfEra = days - era * 146097;
+  long yearOfEra = (dayOfEra - dayOfEra / 1460 + dayOfEra / 36524 - dayOfEra / 146096) / 365;
+  long dayOfYear = dayOfEra - (365 * yearOfEra + yearOfEra / 4 - yearOfEra / 100);
+  long monthIndex = (5 * dayOfYear + 2) / 153;
+  uint8_t day = dayOfYear - (153 * monthIndex + 2) / 5 + 1;
+  uint8_t month = monthIndex < 10 ? monthIndex + 3 : monthIndex - 9;
+  uint16_t year = yearOfEra + era * 400 + (month <= 2 ? 1 : 0);
+  uint32_t seconds = time % 86400;
+  snprintf(out, size, "%04u-%02u-%02u %02u:%02u:%02u +0000", year, month, day,
+           (uint8_t) (seconds / 3600), (uint8_t) (seconds / 60 % 60), (uint8_t) (seconds % 60));
+}
+
+AgruminoThingSpeak::AgruminoThingSpeak(unsigned long channel, const char *writeApiKey, const char *host, uint16_t port)
+: _channel(channel)
+, _writeApiKey(writeApiKey)
+, _host(host)
+, _port(port)
+, _interval(3600)
+, _epoch(0)
+, _fields(defaultFields)
+, _connectRetries(3)
+, _status(0)
+, _uploaded(0)
+, _serverTime(0)
+{
+}
+
+// Seconds between two buffered samples without a time, written as delta_t
+void AgruminoThingSpeak::setInterval(unsigned long seconds) {
+  _interval = seconds;
+}
+
+// Unix time of the device time 0 (Agrumino::getEpoch()): the entries are sent
+// with their created_at. 0 (not anchored) for delta_t
+void AgruminoThingSpeak::setEpoch(uint32_t epoch) {
+  _epoch = epoch;
+}
+
+// Maps a sample to the channel fields, defaultFields() if NULL
+void AgruminoThingSpeak::setFields(AgruminoThingSpeakFields fields) {
+  _fields = fields ? fields : defaultFields;
+}
+
+void AgruminoThingSpeak::setConnectRetries(uint8_t retries) {
+  _connectRetries = retries;
+}
+
+// field1 temperature (°C), field2 soil moisture (raw), field3 illuminance (lux),
+// field4 battery voltage (V), field5 battery level (%)
+void AgruminoThingSpeak::defaultFields(AgruminoJson &json, const AgruminoSample &sample) {
+  json.member("field1", sample.temperature, 2);
+  json.member("field2", sample.soilMoisture, 0);
+  json.member("field3", sample.illuminance, 0);
+  json.member("field4", sample.batteryVoltage, 3);
+  json.member("field5", (unsigned int) sample.batteryLevel);
+}
+
+// Sends the samples, oldest first, on a single connection (left open for the
+// caller). Returns true if every request was accepted.
+bool AgruminoThingSpeak::upload(Client &client, const AgruminoSample *samples, size_t count) {
+  _status = 0;
+  _uploaded = 0;
+  _serverTime = 0;
+  if (!count)
+    return true;
+  if (!samples || !connect(client))
+    return false;
+
+  while (_uploaded < count) {
+    size_t batch = count - _uploaded;
+    if (batch > AGRUMINO_THINGSPEAK_MAX_UPDATES)
+      batch = AGRUMINO_THINGSPEAK_MAX_UPDATES;
+    if (!send(client, samples + _uploaded, batch, _uploaded == 0))
+      return false;
+    _uploaded += batch;
+  }
+  return true;
+}
+
+bool AgruminoThingSpeak::connect(Client &client) {
+  if (client.connected())
+    return true;
+  for (uint8_t i = 0; i <= _connectRetries; i++) {
+    if (client.connect(_host, _port))
+      return true;
+    delay(500);
+  }
+  return false;
+}
+
+// One bulk-update request. The first entry of the upload has delta_t 0, the
+// first entry of a following request is after the last of the previous batch.
+bool AgruminoThingSpeak::send(Client &client, const AgruminoSample *samples, size_t count, bool first) {
+  AgruminoJson counter;
+  writeBody(counter, samples, count, first);
+
+  client.print("POST /channels/");
+  client.print(_channel);
+  client.print("/bulk_update.json HTTP/1.1\r\nHost: ");
+  client.print(_host);
+  client.print("\r\nContent-Type: application/json\r\nConnection: keep-alive\r\nContent-Length: ");
+  client.print((unsigned long) counter.length());
+  client.print("\r\n\r\n");
+
+  AgruminoJson json(client);
+  writeBody(json, samples, count, first);
+  if (!json.flush())
+    return false;
+  return AgruminoHttp::readReply(client, _status, AGRUMINO_THINGSPEAK_TIMEOUT_MS, &_serverTime) && _status >= 200 && _status < 300;
+}
+
+void AgruminoThingSpeak::writeBody(AgruminoJson &json, const AgruminoSample *samples, size_t count, bool first) {
+  json.beginObject();
+  json.member("write_api_key", _writeApiKey);
+  json.key("updates");
+  json.beginArray();
+  for (size_t i = 0; i < count; i++) {
+    json.beginObject();
+    if (_epoch && samples[i].time) {
+      char time[32];
+      formatTime(_epoch + samples[i].time, time, sizeof(time));
+      json.member("created_at", time);
+    } else if (first && i == 0) {
+      json.member("delta_t", 0UL);
+    } else {
+      // samples[-1] is the last of the previous batch for the first entry of a following request
+      const AgruminoSample &previous = samples[(long) i - 1];
+      json.member("delta_t", (unsigned long) (samples[i].time > previous.time && previous.time ? samples[i].time - previous.time : _interval));
+    }
+    _fields(json, samples[i]);
+    json.endObject();
+  }
+  json.endArray();
+  json.endObject();
+}
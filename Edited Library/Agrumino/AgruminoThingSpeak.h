@@ -0,0 +1,90 @@
+/*
+  AgruminoThingSpeak.h - Bulk upload of the buffered samples to ThingSpeak
+  Created for the AgruminoFlash project.
+
+  Sending every buffered hour as its own GET /update costs a TCP connect, an
+  HTTP request and a "Connection: close" per sample, and the radio stays on
+  for all of them. AgruminoThingSpeak sends the whole buffer as a single
+  bulk-update request on one connection:
+
+    POST /channels/<channel>/bulk_update.json
+    {"write_api_key":"<key>","updates":[
+      {"delta_t":0,"field1":...},{"delta_t":3600,"field1":...},...]}
+
+  delta_t is the time, in seconds, from the previous entry: the difference
+  of the times of the samples (see AgruminoClock.h), the sampling interval
+  for the samples without a time. Once the clock of the board has been
+  anchored to the server time (the Date of a reply, getServerTime()), every
+  entry has its own time instead:
+      {"created_at":"2018-03-01 10:00:00 +0000","field1":...}
+  The body is never held in memory: it's streamed by AgruminoJson,
+  once to compute the Content-Length and once to send it.
+  Batches larger than AGRUMINO_THINGSPEAK_MAX_UPDATES are split in several
+  requests on the same kept-alive connection.
+
+  Example:
+    WiFiClient client;
+    AgruminoThingSpeak thingSpeak(CHANNEL_ID, WRITE_API_KEY);
+    thingSpeak.setInterval(SLEEP_TIME_SEC);
+    thingSpeak.setEpoch(agrumino.getEpoch());
+    if (thingSpeak.upload(client, agrumino.getRecords<AgruminoSample>()))
+      agrumino.discardMemory();
+    agrumino.setTime(thingSpeak.getServerTime());
+*/
+
+#ifndef AgruminoThingSpeak_h
+#define AgruminoThingSpeak_h
+
+#include "Arduino.h"
+#include "Client.h"
+#include "AgruminoRecord.h"
+#include "AgruminoJson.h"
+#include "AgruminoHttp.h"
+
+#define AGRUMINO_THINGSPEAK_HOST          "api.thingspeak.com"
+#define AGRUMINO_THINGSPEAK_MAX_UPDATES   960  // Entries accepted by a bulk update (free accounts)
+#define AGRUMINO_THINGSPEAK_TIMEOUT_MS   5000  // Wait for the reply of a request
+
+// Writes the fields of an entry as members of the open object:
+//   json.member("field1", sample.temperature, 2); ...
+typedef void (*AgruminoThingSpeakFields)(AgruminoJson &json, const AgruminoSample &sample);
+
+class AgruminoThingSpeak {
+public:
+  AgruminoThingSpeak(unsigned long channel, const char *writeApiKey, const char *host = AGRUMINO_THINGSPEAK_HOST, uint16_t port = 80);
+
+  void setInterval(unsigned long seconds);
+  void setEpoch(uint32_t epoch);
+  void setFields(AgruminoThingSpeakFields fields);
+  void setConnectRetries(uint8_t retries);
+
+  bool upload(Client &client, const AgruminoSample *samples, size_t count);
+  bool upload(Client &client, AgruminoRecordSpan<AgruminoSample> samples) {
+    return upload(client, samples.begin(), samples.size());
+  }
+
+  int getStatus() {return _status;} // HTTP status of the last request, 0 if no reply
+  size_t getUploaded() {return _uploaded;} // Samples accepted by the last upload()
+  uint32_t getServerTime() {return _serverTime;} // Date of the last reply (unix time), 0 if none
+
+  static void defaultFields(AgruminoJson &json, const AgruminoSample &sample);
+
+protected:
+  bool connect(Client &client);
+  bool send(Client &client, const AgruminoSample *samples, size_t count, bool first);
+  void writeBody(AgruminoJson &json, const AgruminoSample *samples, size_t count, bool first);
+
+  unsigned long _channel;
+  const char *_writeApiKey;
+  const char *_host;
+  uint16_t _port;
+  unsigned long _interval;
+  uint32_t _epoch;
+  AgruminoThingSpeakFields _fields;
+  uint8_t _connectRetries;
+  int _status;
+  size_t _uploaded;
+  uint32_t _serverTime;
+};
+
+#endif
@@ -0,0 +1,159 @@
+/*
+  AgruminoWiFi.cpp - WiFi station connect with a fast reconnect
+  For details @see AgruminoWiFi.h
+*/
+
+#include "AgruminoWiFi.h"
+#include "AgruminoClock.h"
+#include "EEPROM.h"
+#include <ESP8266WiFi.h>
+
+static_assert(sizeof(AgruminoWiFiCache) == AGRUMINO_WIFI_RTC_SIZE, "AgruminoWiFiCache layout changed");
+static_assert(AGRUMINO_WIFI_RTC_BLOCK + AGRUMINO_WIFI_RTC_SIZE / 4 <= AGRUMINO_CLOCK_RTC_BLOCK, "The WiFi cache overlaps the clock");
+
+AgruminoWiFi::AgruminoWiFi(const char *ssid, const char *password)
+: _ssid(ssid)
+, _password(password)
+, _cached(false)
+, _fast(false)
+, _connectMillis(0)
+, _flash(AGRUMINO_WIFI_FLASH_SECTOR, 1)
+, _flashFallback(false)
+, _flashReady(false)
+{
+  memset(&_cache, 0, sizeof(_cache));
+}
+
+// Connects in timeout ms at most: with the cache first, if there is one,
+// then with a full connect. Returns true when connected.
+bool AgruminoWiFi::connect(unsigned long timeout) {
+  unsigned long start = millis();
+  WiFi.persistent(false); // Else every begin() writes the credentials to the flash
+  WiFi.mode(WIFI_STA);
+
+  unsigned long fastTimeout = timeout < AGRUMINO_WIFI_FAST_TIMEOUT_MS ? timeout : AGRUMINO_WIFI_FAST_TIMEOUT_MS;
+  _fast = load() && fastConnect(fastTimeout);
+  bool connected = _fast;
+  if (!connected) {
+    unsigned long elapsed = millis() - start;
+    connected = elapsed < timeout && fullConnect(timeout - elapsed);
+  }
+  _connectMillis = millis() - start;
+  return connected;
+}
+
+// Drops the cache: the next connect() is a full one
+void AgruminoWiFi::forget() {
+  memset(&_cache, 0, sizeof(_cache));
+  _cached = false;
+  ESP.rtcUserMemoryWrite(AGRUMINO_WIFI_RTC_BLOCK, (uint32_t *) &_cache, sizeof(_cache));
+  if (flashReady()) {
+    _flash.clear();
+  }
+}
+
+// Keeps the cache in the flash too, for the wake-ups after a power loss.
+// Returns false if the flash layout leaves no sector for it.
+bool AgruminoWiFi::setFlashFallback(bool enabled) {
+  _flashFallback = enabled && AGRUMINO_WIFI_FLASH_SECTOR != 0;
+  _flashReady = false;
+  return _flashFallback == enabled;
+}
+
+// Straight to the cached access point, with the cached address unless it's
+// time to renew the lease
+bool AgruminoWiFi::fastConnect(unsigned long timeout) {
+  bool dhcp = _cache.reuses >= AGRUMINO_WIFI_MAX_REUSES;
+  if (dhcp) {
+    WiFi.config((uint32_t) 0, (uint32_t) 0, (uint32_t) 0);
+  } else {
+    WiFi.config(IPAddress(_cache.ip), IPAddress(_cache.gateway), IPAddress(_cache.subnet), IPAddress(_cache.dns));
+  }
+  WiFi.begin(_ssid, _password, _cache.channel, _cache.bssid);
+  if (!wait(timeout)) {
+    WiFi.disconnect();
+    return false;
+  }
+  store(dhcp ? 0 : _cache.reuses + 1);
+  return true;
+}
+
+// Scan of every channel and DHCP, the cache is replaced
+bool AgruminoWiFi::fullConnect(unsigned long timeout) {
+  WiFi.config((uint32_t) 0, (uint32_t) 0, (uint32_t) 0);
+  WiFi.begin(_ssid, _password);
+  if (!wait(timeout)) {
+    return false;
+  }
+  store(0);
+  return true;
+}
+
+// Polls the station until it's connected. Gives up at the timeout, or as
+// soon as the access point isn't found or refuses the password.
+bool AgruminoWiFi::wait(unsigned long timeout) {
+  unsigned long start = millis();
+  while (millis() - start < timeout) {
+    wl_status_t status = WiFi.status();
+    if (status == WL_CONNECTED)
+      return true;
+    if (status == WL_NO_SSID_AVAIL || status == WL_CONNECT_FAILED)
+      return false;
+    delay(AGRUMINO_WIFI_POLL_MS);
+  }
+  return false;
+}
+
+// The cache from the RTC memory or, after a power loss, the last one written
+// to the flash (its address is asked to DHCP again, the lease may be over)
+bool AgruminoWiFi::load() {
+  if (ESP.rtcUserMemoryRead(AGRUMINO_WIFI_RTC_BLOCK, (uint32_t *) &_cache, sizeof(_cache)) && _cache.crc == checksum(_cache)) {
+    _cached = true;
+    return true;
+  }
+  _cached = flashReady() && _flash.count() > 0 && _flash.read(_flash.count() - 1, &_cache) && _cache.crc == checksum(_cache);
+  if (_cached) {
+    _cache.reuses = AGRUMINO_WIFI_MAX_REUSES;
+  }
+  return _cached;
+}
+
+// Caches the access point and the address of the current connection. The
+// flash is written only if they changed.
+void AgruminoWiFi::store(uint8_t reuses) {
+  AgruminoWiFiCache cache;
+  memset(&cache, 0, sizeof(cache));
+  memcpy(cache.bssid, WiFi.BSSID(), sizeof(cache.bssid));
+  cache.channel = WiFi.channel();
+  cache.ip = WiFi.localIP();
+  cache.gateway = WiFi.gatewayIP();
+  cache.subnet = WiFi.subnetMask();
+  cache.dns = WiFi.dnsIP();
+  bool changed = !_cached
+                 || memcmp(cache.bssid, _cache.bssid, sizeof(cache.bssid)) != 0 || cache.channel != _cache.channel
+                 || cache.ip != _cache.ip || cache.gateway != _cache.gateway
+                 || cache.subnet != _cache.subnet || cache.dns != _cache.dns;
+  cache.reuses = reuses;
+  cache.crc = checksum(cache);
+
+  _cache = cache;
+  _cached = true;
+  ESP.rtcUserMemoryWrite(AGRUMINO_WIFI_RTC_BLOCK, (uint32_t *) &_cache, sizeof(_cache));
+  if (changed && flashReady()) {
+    _flash.append(&_cache);
+  }
+}
+
+uint32_t AgruminoWiFi::checksum(const AgruminoWiFiCache &cache) {
+  uint32_t crc = EEPROMClass::crc32((const uint8_t *) &cache + 4, sizeof(cache) - 4);
+  crc = EEPROMClass::crc32((const uint8_t *) _ssid, strlen(_ssid) + 1, crc);
+  return EEPROMClass::crc32((const uint8_t *) (_password ? _password : ""), _password ? strlen(_password) : 0, crc);
+}
+
+// Mounts the flash fallback on its first use. A cache of another layout is dropped.
+bool AgruminoWiFi::flashReady() {
+  if (!_flashReady && _flashFallback) {
+    _flashReady = _flash.begin(sizeof(_cache), true);
+  }
+  return _flashReady;
+}
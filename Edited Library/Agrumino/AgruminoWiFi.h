@@ -0,0 +1,90 @@
+/*
+  AgruminoWiFi.h - WiFi station connect with a fast reconnect
+  Created for the AgruminoFlash project.
+
+  WiFi.begin(ssid, password) scans every channel for the access point,
+  associates and then asks DHCP for an address: seconds of radio on at
+  every upload. AgruminoWiFi remembers the access point (BSSID and channel)
+  and the address (IP, gateway, subnet mask, DNS) of the last good connect,
+  and reconnects with them: a single channel probed, no DHCP, a few hundred
+  milliseconds. If the fast reconnect fails (the access point changed
+  channel, a new router...) a full connect follows and replaces the cache.
+
+  The static address is a DHCP lease that the router may give away: every
+  AGRUMINO_WIFI_MAX_REUSES fast reconnects, and after a power loss, the
+  address is asked to DHCP again (the access point is still not scanned).
+
+  The cache is kept in the RTC user memory, from block AGRUMINO_WIFI_RTC_BLOCK
+  (after the wake state of Agrumino, before the clock of AgruminoClock.h): it
+  survives the deep sleep, not a power loss. setFlashFallback(true) keeps it
+  also in a one-sector FlashLog (FlashLog.h) for the wake-ups after a power
+  loss: the sector right below the default FlashLog ring, taken from the
+  SPIFFS area like the ring (a sketch using SPIFFS must not enable it).
+  It fails if the flash layout has no SPIFFS area that large. The flash is
+  written only when the access point or the address change. The CRC of the
+  cache covers the SSID and the password too: new credentials drop it.
+
+  Example:
+    AgruminoWiFi wifi(SSID, PASSWORD);
+    wifi.setFlashFallback(true);      // Optional
+    if (wifi.connect(10000)) {
+      ...upload...
+    }
+*/
+
+#ifndef AgruminoWiFi_h
+#define AgruminoWiFi_h
+
+#include "Arduino.h"
+#include "FlashLog.h"
+
+#define AGRUMINO_WIFI_RTC_BLOCK             34  // First 4 bytes block of the RTC user memory used
+#define AGRUMINO_WIFI_RTC_SIZE              28  // sizeof(AgruminoWiFiCache)
+#define AGRUMINO_WIFI_FLASH_SECTOR  FlashLogClass::filesystemSector(FLASHLOG_SECTORS + 1) // 0 if the SPIFFS area is too small
+#define AGRUMINO_WIFI_FAST_TIMEOUT_MS     1500  // Wait of a fast reconnect before the full connect
+#define AGRUMINO_WIFI_POLL_MS               10
+#define AGRUMINO_WIFI_MAX_REUSES            24  // Fast reconnects with the static address before a DHCP
+
+struct AgruminoWiFiCache {
+  uint32_t crc;       // CRC-32 of the rest, of the SSID and of the password
+  uint8_t bssid[6];
+  uint8_t channel;
+  uint8_t reuses;     // Fast reconnects with the static address since the last DHCP
+  uint32_t ip;        // Network order, as IPAddress
+  uint32_t gateway;
+  uint32_t subnet;
+  uint32_t dns;
+};
+
+class AgruminoWiFi {
+public:
+  AgruminoWiFi(const char *ssid, const char *password);
+
+  bool connect(unsigned long timeout);
+  void forget();
+  bool setFlashFallback(bool enabled);
+
+  bool isFastConnect() {return _fast;} // The last connect() used the cache
+  unsigned long getConnectMillis() {return _connectMillis;}
+
+protected:
+  bool fastConnect(unsigned long timeout);
+  bool fullConnect(unsigned long timeout);
+  bool wait(unsigned long timeout);
+  bool load();
+  void store(uint8_t reuses);
+  uint32_t checksum(const AgruminoWiFiCache &cache);
+  bool flashReady();
+
+  const char *_ssid;
+  const char *_password;
+  AgruminoWiFiCache _cache;
+  bool _cached;        // _cache is valid
+  bool _fast;
+  unsigned long _connectMillis;
+  FlashLogClass _flash;
+  bool _flashFallback; // setFlashFallback(true) succeeded
+  bool _flashReady;    // _flash.begin() done
+};
+
+#endif
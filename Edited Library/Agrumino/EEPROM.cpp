@@ -26,21 +26,39 @@ extern "C" {
 #include "spi_flash.h"
 }
 
-extern "C" uint32_t _SPIFFS_end;
-
 EEPROMClass::EEPROMClass(uint32_t sector)
 : _sector(sector)
 , _data(0)
 , _size(0)
 , _dirty(false)
+, _dirtyPages(0)
+, _journalAddress(-1)
+, _journalSlots(0)
+, _journalSlot(0)
+, _journalLast(-1)
+, _journalSequence(0)
+, _journalHeader(0)
+, _journalHeaderSize(0)
+, _journalValid(false)
+, _stats()
 {
 }
 
 EEPROMClass::EEPROMClass(void)
-: _sector((((uint32_t)&_SPIFFS_end - 0x40200000) / SPI_FLASH_SEC_SIZE))
+: _sector(EEPROM_DEFAULT_SECTOR)
 , _data(0)
 , _size(0)
 , _dirty(false)
+, _dirtyPages(0)
+, _journalAddress(-1)
+, _journalSlots(0)
+, _journalSlot(0)
+, _journalLast(-1)
+, _journalSequence(0)
+, _journalHeader(0)
+, _journalHeaderSize(0)
+, _journalValid(false)
+, _stats()
 {
 }
 
@@ -67,6 +85,8 @@ void EEPROMClass::begin(size_t size) {
   interrupts();
 
   _dirty = false; //make sure dirty is cleared in case begin() is called 2nd+ time
+  _dirtyPages = 0;
+  loadJournal();
 }
 
 void EEPROMClass::end() {
@@ -80,6 +100,7 @@ void EEPROMClass::end() {
   _data = 0;
   _size = 0;
   _dirty = false;
+  _dirtyPages = 0;
 }
 
 
@@ -103,33 +124,146 @@ void EEPROMClass::write(int const address, uint8_t const value) {
   if (*pData != value)
   {
     *pData = value;
-    _dirty = true;
+    setDirty(address, 1);
   }
 }
 
 bool EEPROMClass::commit() {
-  bool ret = false;
   if (!_size)
     return false;
-  if(!_dirty)
-    return true;
   if(!_data)
     return false;
+  if(!_dirty && !journalChanged()) {
+    _stats.skippedCommits++;
+    return true;
+  }
 
+  // Pages that only clear bits (e.g. appends in 0xFF space) are programmed
+  // in place, any other change costs an erase and a rewrite of the sector
+  uint32_t pageCount = (_size + EEPROM_PAGE_SIZE - 1) / EEPROM_PAGE_SIZE;
+  uint32_t pages = 0;
+  bool erase = false;
+  for (uint32_t page = 0; page < pageCount && !erase; page++) {
+    if (!(_dirtyPages & (1UL << page)))
+      continue;
+    int result = comparePage(page);
+    if (result == 2)
+      erase = true;
+    else if (result == 1)
+      pages |= 1UL << page;
+  }
+  if (!erase && !pages && !journalChanged()) {
+    // Changed and then restored: nothing to write
+    _dirty = false;
+    _dirtyPages = 0;
+    _stats.skippedCommits++;
+    return true;
+  }
+
+  int slotAddress = -1;
+  if (_journalAddress >= 0 && _journalAddress + _journalSlots * journalSlotSize() <= _size) {
+    if (_journalSlot >= _journalSlots)
+      erase = true;
+    slotAddress = _journalAddress + (erase ? 0 : _journalSlot) * journalSlotSize();
+  }
+
+  bool ret = true;
   noInterrupts();
-  if(spi_flash_erase_sector(_sector) == SPI_FLASH_RESULT_OK) {
-    if(spi_flash_write(_sector * SPI_FLASH_SEC_SIZE, reinterpret_cast<uint32_t*>(_data), _size) == SPI_FLASH_RESULT_OK) {
-      _dirty = false;
-      ret = true;
-    }
+  uint32_t start = micros();
+  if (erase) {
+    ret = spi_flash_erase_sector(_sector) == SPI_FLASH_RESULT_OK;
+    pages = (pageCount < 32 ? (1UL << pageCount) : 0) - 1;
+    _stats.erases++;
   }
+  _stats.commits++;
+  _stats.flashMicros += micros() - start;
+
+  // The journal slot goes to the next free slot, or to the first one after
+  // an erase. Its stats already count this commit, but not the time spent
+  // programming it (saved by the next commit)
+  if (slotAddress >= 0) {
+    if (erase)
+      memset(_data + _journalAddress, 0xFF, _journalSlots * journalSlotSize());
+    for (uint32_t page = slotAddress / EEPROM_PAGE_SIZE; page <= (slotAddress + journalSlotSize() - 1) / EEPROM_PAGE_SIZE; page++)
+      pages |= 1UL << page;
+  }
+  for (uint32_t page = 0; page < pageCount; page++) {
+    if (pages & (1UL << page))
+      _stats.bytesWritten += (page + 1) * EEPROM_PAGE_SIZE <= _size ? EEPROM_PAGE_SIZE : _size - page * EEPROM_PAGE_SIZE;
+  }
+  if (slotAddress >= 0) {
+    uint8_t *slot = _data + slotAddress;
+    uint32_t sequence = _journalSequence + 1;
+    memset(slot, 0, journalSlotSize());
+    memcpy(slot, &sequence, 4);
+    memcpy(slot + 4, &_stats, sizeof(_stats));
+    if (_journalHeader)
+      memcpy(slot + 4 + sizeof(_stats), _journalHeader, _journalHeaderSize);
+    uint32_t crc = crc32(slot, journalSlotSize() - 4);
+    memcpy(slot + journalSlotSize() - 4, &crc, 4);
+  }
+
+  // Pages are programmed from the last one, so the journal (at the start of
+  // the sector) is written after the data it describes: a reset in between
+  // leaves the previous slot as the newest valid one
+  start = micros();
+  for (uint32_t page = pageCount; page-- > 0 && ret; ) {
+    if (!(pages & (1UL << page)))
+      continue;
+    uint32_t offset = page * EEPROM_PAGE_SIZE;
+    uint32_t size = offset + EEPROM_PAGE_SIZE <= _size ? EEPROM_PAGE_SIZE : _size - offset;
+    ret = spi_flash_write(_sector * SPI_FLASH_SEC_SIZE + offset, reinterpret_cast<uint32_t*>(_data + offset), size) == SPI_FLASH_RESULT_OK;
+  }
+  _stats.flashMicros += micros() - start;
   interrupts();
 
+  if (ret) {
+    _dirty = false;
+    _dirtyPages = 0;
+    if (slotAddress >= 0) {
+      _journalSlot = (slotAddress - _journalAddress) / journalSlotSize() + 1;
+      _journalLast = slotAddress;
+      _journalSequence++;
+      _journalValid = true;
+    }
+  } else {
+    _dirtyPages |= pages; // Compared again (and erased if needed) by the next commit
+  }
   return ret;
 }
 
+// Compares a page of the RAM copy with the flash: 0 if they match, 1 if the
+// page can be programmed in place (no bit goes from 0 to 1), 2 if it needs
+// an erase (or the flash can't be read)
+int EEPROMClass::comparePage(uint32_t const page) {
+  uint32_t buffer[16];
+  uint32_t offset = page * EEPROM_PAGE_SIZE;
+  uint32_t end = offset + EEPROM_PAGE_SIZE <= _size ? offset + EEPROM_PAGE_SIZE : _size;
+  int result = 0;
+  while (offset < end) {
+    uint32_t chunk = end - offset < sizeof(buffer) ? end - offset : sizeof(buffer);
+    noInterrupts();
+    SpiFlashOpResult read = spi_flash_read(_sector * SPI_FLASH_SEC_SIZE + offset, buffer, chunk);
+    interrupts();
+    if (read != SPI_FLASH_RESULT_OK)
+      return 2;
+
+    const uint8_t *flash = reinterpret_cast<const uint8_t*>(buffer);
+    for (uint32_t i = 0; i < chunk; i++) {
+      if (_data[offset + i] == flash[i])
+        continue;
+      if (_data[offset + i] & ~flash[i])
+        return 2;
+      result = 1;
+    }
+    offset += chunk;
+  }
+  return result;
+}
+
 uint8_t * EEPROMClass::getDataPtr() {
   _dirty = true;
+  _dirtyPages = 0xFFFFFFFF;
   return &_data[0];
 }
 
@@ -137,6 +271,80 @@ uint8_t const * EEPROMClass::getConstDataPtr() const {
   return &_data[0];
 }
 
+// Keeps a journal of the metadata in the sector: the counters of stats() and
+// optionally a caller's header (e.g. the registers of a record store), whose
+// RAM copy is saved by every commit in which it changed. The journal takes
+// slots * EEPROM_JOURNAL_SLOT_SIZE(headerSize) bytes from address: every
+// commit writes a new CRC-protected slot, with an increasing sequence number,
+// to the next erased slot, so the journal doesn't force an erase until all
+// the slots are used. begin() restores the newest valid slot into header, so
+// a reset in the middle of a commit leaves the previous one in place.
+void EEPROMClass::setJournal(int const address, uint8_t const slots, void *header, size_t const headerSize) {
+  _journalAddress = slots ? address : -1;
+  _journalSlots = slots;
+  _journalHeader = (uint8_t*) header;
+  _journalHeaderSize = header ? headerSize : 0;
+  loadJournal();
+}
+
+// True if the header differs from the one saved in the newest slot
+bool EEPROMClass::journalChanged() {
+  if (_journalAddress < 0 || !_journalHeader)
+    return false;
+  if (_journalLast < 0)
+    return true;
+  return memcmp(_data + _journalLast + 4 + sizeof(_stats), _journalHeader, _journalHeaderSize) != 0;
+}
+
+// Bounded scan of the slots: they are filled in order after every erase, the
+// first erased one is the next free slot and the newest valid one is the last
+// written slot with a good CRC (a torn slot is skipped, never reused)
+void EEPROMClass::loadJournal() {
+  _journalValid = false;
+  _journalLast = -1;
+  _journalSlot = 0;
+  _journalSequence = 0;
+  if (_journalAddress < 0 || !_data || _journalAddress + _journalSlots * journalSlotSize() > _size)
+    return;
+
+  memset(&_stats, 0, sizeof(_stats));
+  for (; _journalSlot < _journalSlots; _journalSlot++) {
+    const uint8_t *slot = _data + _journalAddress + _journalSlot * journalSlotSize();
+    size_t i = 0;
+    while (i < journalSlotSize() && slot[i] == 0xFF)
+      i++;
+    if (i == journalSlotSize()) // Erased slot
+      break;
+
+    uint32_t sequence, crc;
+    memcpy(&sequence, slot, 4);
+    memcpy(&crc, slot + journalSlotSize() - 4, 4);
+    if (crc != crc32(slot, journalSlotSize() - 4) || (_journalValid && sequence <= _journalSequence))
+      continue;
+    _journalValid = true;
+    _journalLast = slot - _data;
+    _journalSequence = sequence;
+  }
+  if (!_journalValid)
+    return;
+
+  memcpy(&_stats, _data + _journalLast + 4, sizeof(_stats));
+  if (_journalHeader)
+    memcpy(_journalHeader, _data + _journalLast + 4 + sizeof(_stats), _journalHeaderSize);
+}
+
+// CRC-32 (IEEE 802.3), bitwise: the journal slots are a few tens of bytes.
+// Pass the CRC of the previous bytes to continue it over a new block
+uint32_t EEPROMClass::crc32(const uint8_t *data, size_t size, uint32_t crc) {
+  crc = ~crc;
+  while (size--) {
+    crc ^= *data++;
+    for (int bit = 0; bit < 8; bit++)
+      crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+  }
+  return ~crc;
+}
+
 #if !defined(NO_GLOBAL_INSTANCES) && !defined(NO_GLOBAL_EEPROM)
 EEPROMClass EEPROM;
 #endif
@@ -24,6 +24,29 @@
 #include <stdint.h>
 #include <string.h>
 
+// The emulated EEPROM lives in the sector right after the SPIFFS area. A
+// build without the ESP8266 linker script (e.g. extras/host) defines it.
+#ifndef EEPROM_DEFAULT_SECTOR
+extern "C" uint32_t _SPIFFS_end;
+#define EEPROM_DEFAULT_SECTOR (((uint32_t)&_SPIFFS_end - 0x40200000) / SPI_FLASH_SEC_SIZE)
+#endif
+
+// commit() programs only the pages changed since the last commit, and erases
+// the sector only if one of them needs a bit to go from 0 back to 1
+#define EEPROM_PAGE_SIZE 256
+
+// Flash operations done by an EEPROMClass, saved in the journal (see setJournal())
+struct EEPROMStats {
+  uint32_t commits;        // commit() calls that wrote the flash
+  uint32_t erases;         // commits that had to erase the sector
+  uint32_t bytesWritten;   // bytes programmed
+  uint32_t skippedCommits; // commit() calls with nothing to write
+  uint32_t flashMicros;    // time spent in spi_flash_erase_sector/spi_flash_write
+};
+
+// Size of a journal slot: [sequence][EEPROMStats][header, padded to 4][CRC32]
+#define EEPROM_JOURNAL_SLOT_SIZE(headerSize) (4 + sizeof(EEPROMStats) + (((headerSize) + 3) & ~3) + 4)
+
 class EEPROMClass {
 public:
   EEPROMClass(uint32_t sector);
@@ -38,6 +61,10 @@ public:
   uint8_t * getDataPtr();
   uint8_t const * getConstDataPtr() const;
 
+  void setJournal(int const address, uint8_t const slots, void *header = 0, size_t const headerSize = 0);
+  bool journalValid() const {return _journalValid;}
+  const EEPROMStats &stats() const {return _stats;}
+
   template<typename T> 
   T &get(int const address, T &t) {
     if (address < 0 || address + sizeof(T) > _size)
@@ -52,7 +79,7 @@ public:
     if (address < 0 || address + sizeof(T) > _size)
       return t;
     if (memcmp(_data + address, (const uint8_t*)&t, sizeof(T)) != 0) {
-      _dirty = true;
+      setDirty(address, sizeof(T));
       memcpy(_data + address, (const uint8_t*)&t, sizeof(T));
     }
 
@@ -61,6 +88,8 @@ public:
 
   size_t length() {return _size;}
 
+  static uint32_t crc32(const uint8_t *data, size_t size, uint32_t crc = 0);
+
   uint8_t& operator[](int const address) {return getDataPtr()[address];}
   uint8_t const & operator[](int const address) const {return getConstDataPtr()[address];}
 
@@ -69,6 +98,26 @@ protected:
   uint8_t* _data;
   size_t _size;
   bool _dirty;
+  uint32_t _dirtyPages; // Bit n set: page n changed since the last commit
+  int _journalAddress;
+  uint8_t _journalSlots;
+  uint8_t _journalSlot;   // Next free journal slot
+  int _journalLast;       // Address of the newest valid slot, -1 if none
+  uint32_t _journalSequence;
+  uint8_t *_journalHeader;
+  size_t _journalHeaderSize;
+  bool _journalValid;
+  EEPROMStats _stats;
+
+  void setDirty(int const address, size_t const size) {
+    _dirty = true;
+    for (int page = address / EEPROM_PAGE_SIZE; page <= (int) (address + size - 1) / EEPROM_PAGE_SIZE; page++)
+      _dirtyPages |= 1UL << page;
+  }
+  int comparePage(uint32_t const page);
+  size_t journalSlotSize() const {return EEPROM_JOURNAL_SLOT_SIZE(_journalHeaderSize);}
+  bool journalChanged();
+  void loadJournal();
 };
 
 #if !defined(NO_GLOBAL_INSTANCES) && !defined(NO_GLOBAL_EEPROM)
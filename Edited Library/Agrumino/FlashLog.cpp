@@ -0,0 +1,286 @@
+/*
+  FlashLog.cpp - Append-only record log on a ring of ESP8266 flash sectors
+  For details @see FlashLog.h
+*/
+
+#include "Arduino.h"
+#include "FlashLog.h"
+#include "EEPROM.h"
+
+extern "C" {
+#include "c_types.h"
+#include "ets_sys.h"
+#include "os_type.h"
+#include "osapi.h"
+#include "spi_flash.h"
+}
+
+#define FLASHLOG_MAGIC        0x474F4C41 // "ALOG"
+#define FLASHLOG_HEADER_SIZE  12
+#define FLASHLOG_SLOT_FREE    0xFFFFFFFF // Erased flash
+#define FLASHLOG_SLOT_VALID   0x0000A55A // Written after the record
+#define FLASHLOG_SLOT_TORN    0x00000000 // Record interrupted by a reset
+
+// SPIFFS area of the flash layout, [start, end) sectors
+#ifndef FLASHLOG_FS_START_SECTOR
+extern "C" uint32_t _SPIFFS_start;
+extern "C" uint32_t _SPIFFS_end;
+#define FLASHLOG_FS_START_SECTOR (((uint32_t)&_SPIFFS_start - 0x40200000) / SPI_FLASH_SEC_SIZE)
+#define FLASHLOG_FS_END_SECTOR   (((uint32_t)&_SPIFFS_end - 0x40200000) / SPI_FLASH_SEC_SIZE)
+#endif
+
+FlashLogClass::FlashLogClass(uint32_t firstSector, uint8_t sectors)
+: _firstSector(firstSector)
+, _sectors(constrain(sectors, 1, FLASHLOG_MAX_SECTORS))
+, _recordSize(0)
+, _slotSize(0)
+, _slotsPerSector(0)
+, _tail(0)
+, _head(0)
+, _headSlot(0)
+, _headSequence(0)
+, _count(0)
+, _mounted(false)
+, _mismatch(false)
+{
+}
+
+// The last FLASHLOG_SECTORS sectors of the SPIFFS area, none if it's smaller
+FlashLogClass::FlashLogClass(void)
+: _firstSector(filesystemSector(FLASHLOG_SECTORS))
+, _sectors(_firstSector ? FLASHLOG_SECTORS : 0)
+, _recordSize(0)
+, _slotSize(0)
+, _slotsPerSector(0)
+, _tail(0)
+, _head(0)
+, _headSlot(0)
+, _headSequence(0)
+, _count(0)
+, _mounted(false)
+, _mismatch(false)
+{
+}
+
+// First of the last fromEnd sectors of the SPIFFS area, 0 (the boot loader,
+// never a valid choice) if the area has less sectors than that
+uint32_t FlashLogClass::filesystemSector(uint16_t fromEnd) {
+  uint32_t start = FLASHLOG_FS_START_SECTOR;
+  uint32_t end = FLASHLOG_FS_END_SECTOR;
+  if (fromEnd == 0 || end <= start || end - start < fromEnd)
+    return 0;
+  return end - fromEnd;
+}
+
+// Mounts the log: finds the newest sector of the ring and the first free
+// slot in it. A ring written with a different record size is left alone and
+// begin() fails (sizeMismatch()), unless clearMismatch: then it's cleared.
+bool FlashLogClass::begin(size_t recordSize, bool clearMismatch) {
+  _mounted = false;
+  _mismatch = false;
+  if (recordSize == 0 || _sectors == 0)
+    return false;
+
+  _recordSize = recordSize;
+  _slotSize = 4 + ((recordSize + 3) & (~3));
+  if (_slotSize > SPI_FLASH_SEC_SIZE - FLASHLOG_HEADER_SIZE) {
+    _slotsPerSector = 0;
+    return false;
+  }
+  _slotsPerSector = (SPI_FLASH_SEC_SIZE - FLASHLOG_HEADER_SIZE) / _slotSize;
+
+  bool found = false;
+  uint32_t tailSequence = 0;
+  for (uint8_t i = 0; i < _sectors; i++) {
+    uint32_t header[3];
+    if (!flashRead(sectorAddress(i), header, sizeof(header)))
+      return false;
+    if (header[0] != FLASHLOG_MAGIC)
+      continue;
+    if (header[2] != recordSize)
+      _mismatch = true;
+    if (!found || header[1] > _headSequence) {
+      _head = i;
+      _headSequence = header[1];
+    }
+    if (!found || header[1] < tailSequence) {
+      _tail = i;
+      tailSequence = header[1];
+    }
+    found = true;
+  }
+  if (!found)
+    return clear();
+  // The head and its sequence are known: a clear() goes on from them
+  if (_mismatch)
+    return clearMismatch && clear();
+
+  // Sectors before the head are full, only the head must be scanned
+  _headSlot = 0;
+  while (_headSlot < _slotsPerSector) {
+    uint32_t address = slotAddress(_head, _headSlot);
+    uint32_t marker;
+    if (!flashRead(address, &marker, sizeof(marker)))
+      return false;
+    if (marker == FLASHLOG_SLOT_FREE) {
+      if (slotErased(address))
+        break;
+      // Record written but not its marker: burn the slot
+      marker = FLASHLOG_SLOT_TORN;
+      flashWrite(address, &marker, sizeof(marker));
+    }
+    _headSlot++;
+  }
+  _count = ((_head + _sectors - _tail) % _sectors) * _slotsPerSector + _headSlot;
+  _mounted = true;
+  return true;
+}
+
+// Appends a record (recordSize() bytes). When the head sector is full the
+// next sector of the ring is erased and started; if it held the oldest
+// records they are dropped.
+bool FlashLogClass::append(const void *record) {
+  if (!_mounted)
+    return false;
+
+  if (_headSlot >= _slotsPerSector) {
+    uint8_t next = (_head + 1) % _sectors;
+    if (!startSector(next, _headSequence + 1))
+      return false;
+    // The oldest records are gone only once their sector has been erased
+    if (next == _tail) {
+      _tail = (_tail + 1) % _sectors;
+      _count -= _slotsPerSector;
+    }
+  }
+
+  uint32_t address = slotAddress(_head, _headSlot);
+  uint32_t marker = FLASHLOG_SLOT_VALID;
+  bool ok = flashWrite(address + 4, record, _recordSize) && flashWrite(address, &marker, sizeof(marker));
+  // A failed slot is never reused: it would need an erase
+  _headSlot++;
+  _count++;
+  return ok;
+}
+
+// Reads the record at index (0 is the oldest one still in the ring).
+// Returns false if the index is out of range or the slot is torn.
+bool FlashLogClass::read(uint32_t index, void *record) {
+  if (!_mounted || index >= _count)
+    return false;
+
+  uint8_t sector = (_tail + index / _slotsPerSector) % _sectors;
+  uint32_t address = slotAddress(sector, index % _slotsPerSector);
+  uint32_t marker;
+  if (!flashRead(address, &marker, sizeof(marker)) || marker != FLASHLOG_SLOT_VALID)
+    return false;
+  return flashRead(address + 4, record, _recordSize);
+}
+
+// Drops every record. Only the sectors actually used by the log are erased.
+// Also mounts a ring that begin() refused for its record size.
+bool FlashLogClass::clear() {
+  if (!_slotsPerSector || _sectors == 0)
+    return false;
+
+  uint8_t next = (_head + 1) % _sectors;
+  for (uint8_t i = 0; i < _sectors; i++) {
+    uint32_t magic;
+    if (i != next && flashRead(sectorAddress(i), &magic, sizeof(magic)) && magic != FLASHLOG_SLOT_FREE) {
+      noInterrupts();
+      spi_flash_erase_sector(_firstSector + i);
+      interrupts();
+    }
+  }
+  _count = 0;
+  _tail = next;
+  _mismatch = false;
+  _mounted = startSector(next, _headSequence + 1);
+  return _mounted;
+}
+
+uint32_t FlashLogClass::sectorAddress(uint8_t sector) {
+  return (_firstSector + sector) * SPI_FLASH_SEC_SIZE;
+}
+
+uint32_t FlashLogClass::slotAddress(uint8_t sector, uint16_t slot) {
+  return sectorAddress(sector) + FLASHLOG_HEADER_SIZE + (uint32_t) slot * _slotSize;
+}
+
+bool FlashLogClass::startSector(uint8_t sector, uint32_t sequence) {
+  uint32_t header[3] = {FLASHLOG_MAGIC, sequence, (uint32_t) _recordSize};
+
+  noInterrupts();
+  bool ok = spi_flash_erase_sector(_firstSector + sector) == SPI_FLASH_RESULT_OK;
+  interrupts();
+  if (!ok || !flashWrite(sectorAddress(sector), header, sizeof(header)))
+    return false;
+
+  _head = sector;
+  _headSlot = 0;
+  _headSequence = sequence;
+  return true;
+}
+
+// True if the record part of the slot is still erased
+bool FlashLogClass::slotErased(uint32_t address) {
+  uint32_t buffer[8];
+  size_t left = _slotSize - 4;
+  address += 4;
+  while (left > 0) {
+    size_t chunk = left < sizeof(buffer) ? left : sizeof(buffer);
+    if (!flashRead(address, buffer, chunk))
+      return false;
+    for (size_t i = 0; i < chunk / 4; i++) {
+      if (buffer[i] != FLASHLOG_SLOT_FREE)
+        return false;
+    }
+    address += chunk;
+    left -= chunk;
+  }
+  return true;
+}
+
+// spi_flash_read/write want 4 bytes aligned buffers and sizes: go through a
+// small aligned buffer, padding the last word with 0xFF (left erased).
+bool FlashLogClass::flashRead(uint32_t address, void *data, size_t size) {
+  uint32_t buffer[8];
+  uint8_t *out = (uint8_t *) data;
+  while (size > 0) {
+    size_t chunk = size < sizeof(buffer) ? size : sizeof(buffer);
+    noInterrupts();
+    SpiFlashOpResult result = spi_flash_read(address, buffer, (chunk + 3) & (~3));
+    interrupts();
+    if (result != SPI_FLASH_RESULT_OK)
+      return false;
+    memcpy(out, buffer, chunk);
+    address += chunk;
+    out += chunk;
+    size -= chunk;
+  }
+  return true;
+}
+
+bool FlashLogClass::flashWrite(uint32_t address, const void *data, size_t size) {
+  uint32_t buffer[8];
+  const uint8_t *in = (const uint8_t *) data;
+  while (size > 0) {
+    size_t chunk = size < sizeof(buffer) ? size : sizeof(buffer);
+    size_t padded = (chunk + 3) & (~3);
+    memset(buffer, 0xFF, padded);
+    memcpy(buffer, in, chunk);
+    noInterrupts();
+    SpiFlashOpResult result = spi_flash_write(address, buffer, padded);
+    interrupts();
+    if (result != SPI_FLASH_RESULT_OK)
+      return false;
+    address += chunk;
+    in += chunk;
+    size -= chunk;
+  }
+  return true;
+}
+
+#if !defined(NO_GLOBAL_INSTANCES) && !defined(NO_GLOBAL_FLASHLOG)
+FlashLogClass FlashLog;
+#endif
@@ -0,0 +1,82 @@
+/*
+  FlashLog.h - Append-only record log on a ring of ESP8266 flash sectors
+  For the Agrumino board, next to the EEPROM emulation (EEPROM.h).
+
+  EEPROMClass rewrites its whole sector on every commit. FlashLogClass
+  instead appends fixed-size records to the erased (0xFF) space of a ring
+  of sectors: NOR flash can program 1→0 without an erase, so an append is
+  a single small program operation. A sector is erased only when the ring
+  wraps around onto it, dropping the oldest records, and the wear is spread
+  over all the sectors of the ring.
+
+  Sector layout:
+    [magic][sequence][record size]  12 bytes header, sequence grows by 1 for
+                                    every sector started
+    [marker][record...]             slots, record padded to 4 bytes
+  The slot marker is written after the record, so a record interrupted by a
+  reset is never reported as valid. Torn slots are found (and skipped) by
+  begin().
+
+  The default ring (FlashLogClass(void), the global FlashLog) takes the last
+  FLASHLOG_SECTORS sectors of the SPIFFS area, right below the EEPROM
+  sector: they are taken from the filesystem, so a sketch that logs can't
+  use SPIFFS too (or must pass another range). If the flash layout has no
+  SPIFFS area that large (e.g. "no FS"), the default ring is empty and
+  begin() fails instead of erasing sketch or OTA space. A build without the
+  ESP8266 linker script (e.g. extras/host) defines the area with
+  FLASHLOG_FS_START_SECTOR and FLASHLOG_FS_END_SECTOR.
+*/
+
+#ifndef FlashLog_h
+#define FlashLog_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define FLASHLOG_SECTORS        4 // Default ring size, the last sectors of the SPIFFS area
+#define FLASHLOG_MAX_SECTORS   32
+
+class FlashLogClass {
+public:
+  FlashLogClass(uint32_t firstSector, uint8_t sectors);
+  FlashLogClass(void);
+
+  bool begin(size_t recordSize, bool clearMismatch = false);
+  bool append(const void *record);
+  bool read(uint32_t index, void *record);
+  bool clear();
+
+  uint32_t count() {return _count;}
+  uint32_t capacity() {return (uint32_t) _slotsPerSector * _sectors;}
+  size_t recordSize() {return _recordSize;}
+  bool sizeMismatch() {return _mismatch;} // The last begin() found a ring of another record size
+
+  static uint32_t filesystemSector(uint16_t fromEnd);
+
+protected:
+  uint32_t sectorAddress(uint8_t sector);
+  uint32_t slotAddress(uint8_t sector, uint16_t slot);
+  bool startSector(uint8_t sector, uint32_t sequence);
+  bool slotErased(uint32_t address);
+  bool flashRead(uint32_t address, void *data, size_t size);
+  bool flashWrite(uint32_t address, const void *data, size_t size);
+
+  uint32_t _firstSector;
+  uint8_t _sectors;
+  size_t _recordSize;
+  size_t _slotSize;
+  uint16_t _slotsPerSector;
+  uint8_t _tail;      // Ring index of the sector holding the oldest records
+  uint8_t _head;      // Ring index of the sector being appended
+  uint16_t _headSlot; // Next free slot of the head sector
+  uint32_t _headSequence;
+  uint32_t _count;
+  bool _mounted;      // begin() or clear() succeeded: append() and read() can go
+  bool _mismatch;
+};
+
+#if !defined(NO_GLOBAL_INSTANCES) && !defined(NO_GLOBAL_FLASHLOG)
+extern FlashLogClass FlashLog;
+#endif
+
+#endif
@@ -9,7 +9,7 @@
 #include <DNSServer.h>          // Installed from ESP8266 board
 #include <ESP8266WebServer.h>   // Installed from ESP8266 board
 #include <WiFiManager.h>        // https://github.com/tzapu/WiFiManager
-#include <ArduinoJson.h>        // https://github.com/bblanchon/ArduinoJson
+#include "AgruminoJson.h"       // Streaming Json writer of the Agrumino lib
 
 // Time to sleep in second between the readings/data sending
 #define SLEEP_TIME_SEC 300 // 5 min
@@ -22,8 +22,6 @@ const String WEB_SERVER_API_SEND_DATA = "/dweet/quietly/for/"; // The Dweet name
 // Our super cool lib
 Agrumino agrumino;
 
-// Used for sending Json POST requests
-StaticJsonBuffer<200> jsonBuffer;
 // Used to create TCP connections and make Http calls
 WiFiClient client;
 
@@ -142,7 +140,9 @@ void loop() {
 
 void sendData(String dweetName, float temp, int soil, unsigned int lux, float batt, unsigned int battLevel, boolean usb, boolean charge) {
 
-  String bodyJsonString = getSendDataBodyJsonString(temp,  soil,  lux,  batt, battLevel, usb, charge );
+  // The body is streamed to the client: a first pass only counts its length
+  AgruminoJson counter;
+  writeSendDataBody(counter, temp,  soil,  lux,  batt, battLevel, usb, charge);
 
   // Use WiFiClient class to create TCP connections, we try until the connection is estabilished
   while (!client.connect(WEB_SERVER_HOST, 80)) {
@@ -158,15 +158,28 @@ void sendData(String dweetName, float temp, int soil, unsigned int lux, float ba
 
   // Print the HTTP POST API data for debug
   Serial.println("Requesting POST: " + String(WEB_SERVER_HOST) + WEB_SERVER_API_SEND_DATA + dweetName);
-  Serial.println("Requesting POST: " + bodyJsonString);
+  Serial.print("Requesting POST: ");
+  {
+    AgruminoJson json(Serial);
+    writeSendDataBody(json, temp,  soil,  lux,  batt, battLevel, usb, charge);
+  }
+  Serial.println();
 
   // This will send the request to the server
-  client.println("POST " + WEB_SERVER_API_SEND_DATA + dweetName + " HTTP/1.1");
-  client.println("Host: " + String(WEB_SERVER_HOST) + ":80");
+  client.print("POST ");
+  client.print(WEB_SERVER_API_SEND_DATA);
+  client.print(dweetName);
+  client.println(" HTTP/1.1");
+  client.print("Host: ");
+  client.print(WEB_SERVER_HOST);
+  client.println(":80");
   client.println("Content-Type: application/json");
-  client.println("Content-Length: " + String(bodyJsonString.length()));
+  client.print("Content-Length: ");
+  client.println((unsigned long) counter.length());
   client.println();
-  client.println(bodyJsonString);
+  AgruminoJson json(client);
+  writeSendDataBody(json, temp,  soil,  lux,  batt, battLevel, usb, charge);
+  json.flush();
 
   delay(10);
 
@@ -198,21 +211,18 @@ void sendData(String dweetName, float temp, int soil, unsigned int lux, float ba
   Serial.println(response);
 }
 
-// Returns the Json body that will be sent to the send data HTTP POST API
-String getSendDataBodyJsonString(float temp, int soil, unsigned int lux, float batt, unsigned int battLevel, boolean usb, boolean charge) {
-  JsonObject& jsonPost = jsonBuffer.createObject();
-  jsonPost["temp"] = String(temp);
-  jsonPost["soil"] = String(soil);
-  jsonPost["lux"]  = String(lux);
-  jsonPost["battVolt"] = String(batt);
-  jsonPost["battLevel"] = String(battLevel);
-  jsonPost["battCharging"] = String(charge);
-  jsonPost["usbConnected"]  = String(usb);
-
-  String jsonPostString;
-  jsonPost.printTo(jsonPostString);
-
-  return jsonPostString;
+// Writes the Json body that will be sent to the send data HTTP POST API.
+// The values are strings, as dweet consumers received them before
+void writeSendDataBody(AgruminoJson &json, float temp, int soil, unsigned int lux, float batt, unsigned int battLevel, boolean usb, boolean charge) {
+  json.beginObject();
+  json.member("temp", String(temp).c_str());
+  json.member("soil", String(soil).c_str());
+  json.member("lux", String(lux).c_str());
+  json.member("battVolt", String(batt).c_str());
+  json.member("battLevel", String(battLevel).c_str());
+  json.member("battCharging", String(charge).c_str());
+  json.member("usbConnected", String(usb).c_str());
+  json.endObject();
 }
 
 
@@ -9,7 +9,7 @@
 #include <DNSServer.h>          // Installed from ESP8266 board
 #include <ESP8266WebServer.h>   // Installed from ESP8266 board
 #include <WiFiManager.h>        // https://github.com/tzapu/WiFiManager
-#include <ArduinoJson.h>        // https://github.com/bblanchon/ArduinoJson
+#include "AgruminoJson.h"       // Streaming Json writer of the Agrumino lib
 
 // Time to sleep in second between the readings/data sending
 #define SLEEP_TIME_SEC 30
@@ -23,8 +23,6 @@ const String WEB_SERVER_API_SEND_DATA = "/api/v1/objects/device_observation/";
 // Our super cool lib
 Agrumino agrumino;
 
-// Used for sending Json POST requests
-StaticJsonBuffer<500> jsonBuffer;
 // Used to create TCP connections and make Http calls
 WiFiClient client;
 
@@ -125,18 +123,31 @@ void sendData(String thingName, float temp, int soil, unsigned int lux, float ba
   Serial.println("##################################\n");
 
   // TODO: Call registerDevice one time and save token in eeprom
-  String registerBody = getRegisterBodyJsonString(thingName);
-  doPostApiCall(WEB_SERVER_HOST, WEB_SERVER_API_REGISTER , registerBody);
+  // The bodies are streamed to the client: a first pass only counts their length
+  AgruminoJson registerCounter;
+  writeRegisterBody(registerCounter, thingName);
+  beginPostApiCall(WEB_SERVER_HOST, WEB_SERVER_API_REGISTER, registerCounter.length());
+  {
+    AgruminoJson json(client);
+    writeRegisterBody(json, thingName);
+  }
+  endPostApiCall();
 
   // This shoul be read from the register API response
   String deviceToken = "TODO";
 
   // TODO: Send a real token when the backend will use it
-  String sendDataBody = getSendDataBodyJsonString(thingName, deviceToken, temp,  soil,  lux,  batt, battLevel, usb, charge);
-  doPostApiCall(WEB_SERVER_HOST, WEB_SERVER_API_SEND_DATA , sendDataBody);
+  AgruminoJson sendDataCounter;
+  writeSendDataBody(sendDataCounter, thingName, deviceToken, temp,  soil,  lux,  batt, battLevel, usb, charge);
+  beginPostApiCall(WEB_SERVER_HOST, WEB_SERVER_API_SEND_DATA, sendDataCounter.length());
+  {
+    AgruminoJson json(client);
+    writeSendDataBody(json, thingName, deviceToken, temp,  soil,  lux,  batt, battLevel, usb, charge);
+  }
+  endPostApiCall();
 }
 
-void doPostApiCall(const char* host, String api, String bodyJsonString) {
+void beginPostApiCall(const char* host, String api, size_t contentLength) {
 
   // Use WiFiClient class to create TCP connections, we try until the connection is estabilished
   while (!client.connect(host, 80)) {
@@ -147,15 +158,21 @@ void doPostApiCall(const char* host, String api, String bodyJsonString) {
 
   // Print the HTTP POST API data for debug
   Serial.println("Requesting POST: " + String(host) + api);
-  Serial.println("Requesting POST: " + bodyJsonString);
 
-  // This will send the request to the server
-  client.println("POST " + api + " HTTP/1.1");
-  client.println("Host: " + String(host) + ":80");
+  // This will send the request to the server, the body is written by the caller
+  client.print("POST ");
+  client.print(api);
+  client.println(" HTTP/1.1");
+  client.print("Host: ");
+  client.print(host);
+  client.println(":80");
   client.println("Content-Type: application/json");
-  client.println("Content-Length: " + String(bodyJsonString.length()));
+  client.print("Content-Length: ");
+  client.println((unsigned long) contentLength);
   client.println();
-  client.println(bodyJsonString);
+}
+
+void endPostApiCall() {
 
   delay(10);
 
@@ -187,40 +204,31 @@ void doPostApiCall(const char* host, String api, String bodyJsonString) {
   Serial.println(response);
 }
 
-// Returns the Json body that will be sent to the register device HTTP POST API
-String getRegisterBodyJsonString(String deviceKey) {
-  JsonObject& jsonPost = jsonBuffer.createObject();
-  jsonPost["key"] = String(deviceKey);
-
-  String jsonPostString;
-  jsonPost.printTo(jsonPostString);
-
-  return jsonPostString;
+// Writes the Json body that will be sent to the register device HTTP POST API
+void writeRegisterBody(AgruminoJson &json, String deviceKey) {
+  json.beginObject();
+  json.member("key", deviceKey.c_str());
+  json.endObject();
 }
 
-// Returns the Json body that will be sent to the send data HTTP POST API
-String getSendDataBodyJsonString(String deviceKey, String deviceToken, float temp, int soil, unsigned int lux, float batt, unsigned int battLevel, boolean usb, boolean charge) {
-  JsonObject& jsonPost = jsonBuffer.createObject();
+// Writes the Json body that will be sent to the send data HTTP POST API
+void writeSendDataBody(AgruminoJson &json, String deviceKey, String deviceToken, float temp, int soil, unsigned int lux, float batt, unsigned int battLevel, boolean usb, boolean charge) {
+  json.beginObject();
 
-  jsonPost["device_key"] = String(deviceKey);
-  jsonPost["device_token"] = String(deviceKey);
-  jsonPost["temperature"] = String(temp);
-  jsonPost["humidity"] = String(soil);
-  jsonPost["battery"] = String(battLevel);
-  jsonPost["lum"]  = String(lux);
-  // jsonPost["water"]  = Not present
+  json.member("device_key", deviceKey.c_str());
+  json.member("device_token", deviceKey.c_str());
+  json.member("temperature", String(temp).c_str());
+  json.member("humidity", String(soil).c_str());
+  json.member("battery", String(battLevel).c_str());
+  json.member("lum", String(lux).c_str());
+  // json.member("water", ...) Not present
 
   // Present but not supported yet by the backend
-  jsonPost["battVolt"] = String(batt);
-  jsonPost["battCharging"] = String(charge);
-  jsonPost["usbConnected"]  = String(usb);
-
-
-
-  String jsonPostString;
-  jsonPost.printTo(jsonPostString);
+  json.member("battVolt", String(batt).c_str());
+  json.member("battCharging", String(charge).c_str());
+  json.member("usbConnected", String(usb).c_str());
 
-  return jsonPostString;
+  json.endObject();
 }
 
 
@@ -0,0 +1,118 @@
+/*
+  HostClient.cpp - WiFiClient of the host build, on a POSIX TCP socket.
+
+  The network is real, the time is not: a read that finds no data waits up
+  to HOST_CLIENT_POLL_MS of real time and advances the virtual clock by 1 ms,
+  so the timeouts of the uploaders still hold.
+*/
+
+#include "HostSim.h"
+#include "WiFiClient.h"
+
+#include <netdb.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define HOST_CLIENT_POLL_MS 10
+
+WiFiClient::WiFiClient()
+: _fd(-1), _eof(false), _start(0), _end(0) {
+}
+
+WiFiClient::~WiFiClient() {
+  stop();
+}
+
+int WiFiClient::connect(const char *host, uint16_t port) {
+  stop();
+  char service[8];
+  snprintf(service, sizeof(service), "%u", port);
+  struct addrinfo hints = {}, *addresses;
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  if (getaddrinfo(host, service, &hints, &addresses))
+    return 0;
+  for (struct addrinfo *a = addresses; a && _fd < 0; a = a->ai_next) {
+    _fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+    if (_fd >= 0 && ::connect(_fd, a->ai_addr, a->ai_addrlen)) {
+      close(_fd);
+      _fd = -1;
+    }
+  }
+  freeaddrinfo(addresses);
+  _eof = false;
+  _start = _end = 0;
+  return _fd >= 0;
+}
+
+size_t WiFiClient::write(uint8_t c) {
+  return write(&c, 1);
+}
+
+size_t WiFiClient::write(const uint8_t *buffer, size_t size) {
+  size_t sent = 0;
+  while (_fd >= 0 && sent < size) {
+    ssize_t n = send(_fd, buffer + sent, size - sent, MSG_NOSIGNAL);
+    if (n <= 0) {
+      stop();
+      break;
+    }
+    sent += n;
+  }
+  return sent;
+}
+
+// Reads what the socket has, waiting a little if it has nothing
+bool WiFiClient::fill() {
+  if (_start < _end)
+    return true;
+  if (_fd < 0 || _eof)
+    return false;
+  struct pollfd p = {_fd, POLLIN, 0};
+  if (poll(&p, 1, HOST_CLIENT_POLL_MS) <= 0) {
+    HostSim::advance(1000);
+    return false;
+  }
+  ssize_t n = recv(_fd, _buffer, sizeof(_buffer), 0);
+  if (n <= 0) {
+    _eof = true;
+    return false;
+  }
+  _start = 0;
+  _end = n;
+  return true;
+}
+
+int WiFiClient::available() {
+  fill();
+  return _end - _start;
+}
+
+int WiFiClient::read() {
+  return fill() ? _buffer[_start++] : -1;
+}
+
+int WiFiClient::read(uint8_t *buffer, size_t size) {
+  if (!fill())
+    return -1;
+  size_t n = _end - _start < size ? _end - _start : size;
+  memcpy(buffer, _buffer + _start, n);
+  _start += n;
+  return n;
+}
+
+int WiFiClient::peek() {
+  return fill() ? _buffer[_start] : -1;
+}
+
+void WiFiClient::stop() {
+  if (_fd >= 0)
+    close(_fd);
+  _fd = -1;
+  _start = _end = 0;
+}
+
+uint8_t WiFiClient::connected() {
+  return _fd >= 0 && (!_eof || _start < _end);
+}
@@ -0,0 +1,229 @@
+/*
+  HostCore.cpp - Simulated Arduino core for the Agrumino host build.
+
+  Time is virtual: millis()/micros() only advance through delay(), through
+  the modelled cost of flash and I2C operations and across deep sleep, so a
+  run is deterministic and a 10 minutes sleep does not take 10 minutes.
+*/
+
+#include "HostSim.h"
+
+#include <stdarg.h>
+#include <unistd.h>
+
+extern "C" {
+#include "user_interface.h"
+}
+
+HardwareSerial Serial;
+EspClass ESP;
+
+static uint8_t pinModes[32];
+static uint8_t pinStates[32];
+
+/////////////
+// Helpers //
+/////////////
+
+long map(long x, long in_min, long in_max, long out_min, long out_max) {
+  return (x - in_min) * (out_max - out_min) / (in_max - in_min) + out_min;
+}
+
+///////////////////////
+// Time / interrupts //
+///////////////////////
+
+unsigned long millis() {
+  return (unsigned long) (HostSim::awakeMicros() / 1000);
+}
+
+unsigned long micros() {
+  return (unsigned long) HostSim::awakeMicros();
+}
+
+void delay(unsigned long ms) {
+  HostSim::advance((uint64_t) ms * 1000);
+}
+
+void delayMicroseconds(unsigned int us) {
+  HostSim::advance(us);
+}
+
+void yield() {
+}
+
+void noInterrupts() {
+}
+
+void interrupts() {
+}
+
+//////////
+// GPIO //
+//////////
+
+void pinMode(uint8_t pin, uint8_t mode) {
+  if (pin < 32) pinModes[pin] = mode;
+}
+
+void digitalWrite(uint8_t pin, uint8_t val) {
+  if (pin >= 32) return;
+  if (pin == HOST_PIN_BOARD_POWER && val && !pinStates[pin]) HostSim::i2cReset(); // the sensors power up
+  pinStates[pin] = val ? HIGH : LOW;
+}
+
+int digitalRead(uint8_t pin) {
+  if (pin >= 32) return LOW;
+  if (pinModes[pin] == OUTPUT) return pinStates[pin];
+  return HostSim::readInputPin(pin);
+}
+
+int analogRead(uint8_t pin) {
+  HostSim::advance(HOST_ADC_READ_US);
+  return pin == A0 ? HostSim::readAdc() : 0;
+}
+
+// Burst of readings of A0, only with the radio off on the board
+void system_adc_read_fast(uint16_t *adc_addr, uint16_t adc_num, uint8_t adc_clk_div) {
+  if (wifi_get_opmode() != NULL_MODE) {
+    fprintf(stderr, "[sim] system_adc_read_fast() with the WiFi on\n");
+    abort();
+  }
+  HostSim::advance((uint64_t) adc_num * HOST_ADC_FAST_US * adc_clk_div / 8);
+  for (uint16_t i = 0; i < adc_num; i++) {
+    adc_addr[i] = HostSim::readAdc();
+  }
+}
+
+////////////
+// Serial //
+////////////
+
+void HardwareSerial::begin(unsigned long baud) {
+  (void) baud;
+}
+
+size_t HardwareSerial::write(uint8_t c) {
+  if (HostSim::verbose()) fputc(c, stdout);
+  return 1;
+}
+
+size_t HardwareSerial::write(const uint8_t *buffer, size_t size) {
+  if (HostSim::verbose()) fwrite(buffer, 1, size, stdout);
+  return size;
+}
+
+/////////
+// ESP //
+/////////
+
+void EspClass::deepSleep(uint64_t timeUs) {
+  HostSim::deepSleep(timeUs);
+}
+
+void EspClass::reset() {
+  HostSim::deepSleep(0);
+}
+
+void EspClass::restart() {
+  HostSim::deepSleep(0);
+}
+
+uint32_t EspClass::getChipId() {
+  return 0x00A6B1C0;
+}
+
+bool EspClass::rtcUserMemoryRead(uint32_t offset, uint32_t *data, size_t size) {
+  return HostSim::rtcRead(offset, data, size);
+}
+
+bool EspClass::rtcUserMemoryWrite(uint32_t offset, uint32_t *data, size_t size) {
+  return HostSim::rtcWrite(offset, data, size);
+}
+
+uint32_t EspClass::getCycleCount() {
+  return (uint32_t) (HostSim::awakeMicros() * 80);
+}
+
+// RTC clock period in us, Q12
+uint32_t system_rtc_clock_cali_proc(void) {
+  return (uint32_t) (HostSim::rtcPeriod() * 4096 + 0.5);
+}
+
+///////////
+// Print //
+///////////
+
+size_t Print::write(const uint8_t *buffer, size_t size) {
+  size_t n = 0;
+  while (size--) n += write(*buffer++);
+  return n;
+}
+
+size_t Print::print(long n, int base) {
+  if (base == DEC) return printf("%ld", n);
+  return print((unsigned long) n, base);
+}
+
+size_t Print::print(unsigned long n, int base) {
+  char buf[8 * sizeof(long) + 1];
+  char *str = &buf[sizeof(buf) - 1];
+  *str = '\0';
+  if (base < 2) base = 10;
+  do {
+    char c = n % base;
+    n /= base;
+    *--str = c < 10 ? c + '0' : c + 'A' - 10;
+  } while (n);
+  return write(str);
+}
+
+size_t Print::print(double n, int digits) {
+  return printf("%.*f", digits, n);
+}
+
+size_t Print::printf(const char *format, ...) {
+  char buf[256];
+  va_list args;
+  va_start(args, format);
+  int len = vsnprintf(buf, sizeof(buf), format, args);
+  va_end(args);
+  if (len < 0) return 0;
+  if ((size_t) len >= sizeof(buf)) len = sizeof(buf) - 1;
+  return write((const uint8_t *) buf, len);
+}
+
+////////////
+// String //
+////////////
+
+static std::string formatInteger(unsigned long value, unsigned char base, bool negative) {
+  char buf[8 * sizeof(long) + 2];
+  char *str = &buf[sizeof(buf) - 1];
+  *str = '\0';
+  if (base < 2) base = 10;
+  do {
+    char c = value % base;
+    value /= base;
+    *--str = c < 10 ? c + '0' : c + 'a' - 10;
+  } while (value);
+  if (negative) *--str = '-';
+  return std::string(str);
+}
+
+String::String(int value, unsigned char base) : String((long) value, base) {}
+
+String::String(unsigned int value, unsigned char base) : String((unsigned long) value, base) {}
+
+String::String(long value, unsigned char base)
+  : _str(base == 10 && value < 0 ? formatInteger(-(unsigned long) value, base, true) : formatInteger((unsigned long) value, base, false)) {}
+
+String::String(unsigned long value, unsigned char base) : _str(formatInteger(value, base, false)) {}
+
+String::String(float value, unsigned char decimalPlaces) : String((double) value, decimalPlaces) {}
+
+String::String(double value, unsigned char decimalPlaces) {
+  char buf[48];
+  snprintf(buf, sizeof(buf), "%.*f", decimalPlaces, value);
+  _str = buf;
+}
@@ -0,0 +1,85 @@
+/*
+  HostFlash.cpp - SPI flash model of the Agrumino host build.
+
+  The 4 MB flash is an mmap'd image file, created erased (0xFF). Programming
+  follows NOR rules: it can only clear bits, so a write that tries to bring
+  a 0 back to 1 without an erase is counted as illegal (and, like the real
+  chip, leaves the 0 in place).
+*/
+
+#include "HostSim.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+extern "C" {
+#include "spi_flash.h"
+}
+
+static const size_t FLASH_SIZE = 4 * 1024 * 1024;
+
+static uint8_t *flash = NULL;
+
+namespace HostSim {
+
+void flashOpen() {
+  const char *path = getenv("AGRUMINO_SIM_FLASH");
+  if (!path || !*path) path = "agrumino_flash.bin";
+  int fd = open(path, O_RDWR | O_CREAT, 0644);
+  if (fd < 0) {
+    perror(path);
+    exit(1);
+  }
+  struct stat st;
+  fstat(fd, &st);
+  bool fresh = (size_t) st.st_size != FLASH_SIZE;
+  if (fresh && ftruncate(fd, FLASH_SIZE) != 0) {
+    perror(path);
+    exit(1);
+  }
+  flash = (uint8_t *) mmap(NULL, FLASH_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (flash == MAP_FAILED) {
+    perror("mmap");
+    exit(1);
+  }
+  if (fresh) memset(flash, 0xFF, FLASH_SIZE);
+}
+
+void flashSync() {
+  if (flash) msync(flash, FLASH_SIZE, MS_SYNC);
+}
+
+} // namespace HostSim
+
+SpiFlashOpResult spi_flash_erase_sector(uint16_t sec) {
+  if ((size_t) (sec + 1) * SPI_FLASH_SEC_SIZE > FLASH_SIZE) return SPI_FLASH_RESULT_ERR;
+  memset(flash + sec * SPI_FLASH_SEC_SIZE, 0xFF, SPI_FLASH_SEC_SIZE);
+  HostSim::stats().flashErases++;
+  HostSim::stats().flashMicros += HOST_FLASH_ERASE_US;
+  HostSim::advance(HOST_FLASH_ERASE_US);
+  return SPI_FLASH_RESULT_OK;
+}
+
+SpiFlashOpResult spi_flash_write(uint32_t des_addr, uint32_t *src_addr, uint32_t size) {
+  if ((des_addr & 3) || (size & 3) || des_addr + size > FLASH_SIZE) return SPI_FLASH_RESULT_ERR;
+  const uint8_t *src = (const uint8_t *) src_addr;
+  for (uint32_t i = 0; i < size; i++) {
+    if (src[i] & ~flash[des_addr + i]) HostSim::stats().flashIllegalPrograms++;
+    flash[des_addr + i] &= src[i];
+  }
+  uint32_t pages = (des_addr % 256 + size + 255) / 256;
+  HostSim::stats().flashBytesProgrammed += size;
+  HostSim::stats().flashMicros += pages * HOST_FLASH_PAGE_US;
+  HostSim::advance(pages * HOST_FLASH_PAGE_US);
+  return SPI_FLASH_RESULT_OK;
+}
+
+SpiFlashOpResult spi_flash_read(uint32_t src_addr, uint32_t *des_addr, uint32_t size) {
+  if (src_addr + size > FLASH_SIZE) return SPI_FLASH_RESULT_ERR;
+  memcpy(des_addr, flash + src_addr, size);
+  HostSim::advance((size * HOST_FLASH_READ_US_PER_KB) / 1024);
+  return SPI_FLASH_RESULT_OK;
+}
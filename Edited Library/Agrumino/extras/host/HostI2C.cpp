@@ -0,0 +1,313 @@
+/*
+  HostI2C.cpp - I2C bus and device models of the Agrumino host build.
+
+  Every sensor on the board is a small register model whose readings are
+  replayed from the sensor script (see HostSim.h):
+    0x48 MCP9800  temperature   script key "temp"  (°C)
+    0x4D MCP3221  soil ADC      script key "soil"  (12 bit counts)
+    0x44 ISL29003 light         script key "lux"   (lux)
+    0x41 PCA9536  GPIO expander (bottom led on IO0)
+  A device whose address is listed in the "absent" script key NACKs
+  (e.g. "absent 68" unplugs the light sensor), one listed in "stuck" holds
+  SCL low until the clock stretching limit of the master, one listed in
+  "flaky" NACKs one bus transfer out of three.
+*/
+
+#include "HostSim.h"
+#include "Wire.h"
+
+TwoWire Wire;
+
+namespace {
+
+struct Mcp9800 {
+  uint8_t pointer;
+  uint8_t config;
+  uint16_t temp;
+  bool converting;
+  uint64_t readyAt;
+
+  // 30 ms at 9 bit, doubling with every bit of resolution
+  static uint64_t conversionUs(uint8_t config) {
+    return 30000ULL << ((config >> 5) & 3);
+  }
+
+  void reset() {
+    pointer = 0;
+    config = 0;
+    temp = 0; // until the first conversion after the power up
+    start();
+  }
+
+  void start() {
+    converting = true;
+    readyAt = HostSim::awakeMicros() + conversionUs(config);
+  }
+
+  void convert() {
+    // 12 bit two's complement, 1/16 °C in the upper 12 bits
+    int16_t value = (int16_t) lroundf(HostSim::scriptValue("temp", 21.5f) * 16.0f);
+    uint8_t bits = 9 + ((config >> 5) & 3);
+    value &= ~((1 << (12 - bits)) - 1);
+    temp = (uint16_t) (value << 4);
+  }
+
+  // Continuous mode keeps converting, shutdown mode only after a one-shot
+  void update() {
+    if (!converting || HostSim::awakeMicros() < readyAt) return;
+    convert();
+    converting = !(config & 0x01);
+  }
+
+  void write(const uint8_t *data, size_t length) {
+    pointer = data[0] & 3;
+    if (length > 1 && pointer == 1) {
+      update();
+      bool shutdown = config & 0x01;
+      config = data[1] & 0x7F;
+      if ((config & 0x01) && (data[1] & 0x80)) start(); // one-shot: converting in the background
+      else if (shutdown && !(config & 0x01)) start();  // back to continuous mode
+    }
+  }
+
+  size_t read(uint8_t *buffer, size_t length) {
+    update(); // the ONE_SHOT bit reads 1 until the conversion is over
+    for (size_t i = 0; i < length; i++) {
+      switch (pointer) {
+        case 0:  buffer[i] = i == 0 ? temp >> 8 : temp & 0xFF; break;
+        case 1:  buffer[i] = config | (converting && (config & 0x01) ? 0x80 : 0); break;
+        default: buffer[i] = 0; break;
+      }
+    }
+    return length;
+  }
+};
+
+struct Mcp3221 {
+  size_t read(uint8_t *buffer, size_t length) {
+    uint16_t value = (uint16_t) constrain((int) HostSim::scriptValue("soil", 2600), 0, 4095);
+    for (size_t i = 0; i < length; i++) buffer[i] = i == 0 ? value >> 8 : value & 0xFF;
+    return length;
+  }
+};
+
+struct Isl29003 {
+  uint8_t pointer;
+  uint8_t regs[8];
+  bool converting;
+  uint64_t readyAt;
+
+  void reset() {
+    pointer = 0;
+    memset(regs, 0, sizeof(regs));
+    converting = false;
+  }
+
+  uint8_t bits() {
+    return 16 - 4 * ((regs[1] >> 2) & 3);
+  }
+
+  // About 90 ms at 16 bit, 16 times shorter for every 4 bits less
+  void start() {
+    converting = true;
+    readyAt = HostSim::awakeMicros() + (90000ULL >> (16 - bits()));
+  }
+
+  void convert() {
+    static const float ranges[4] = { 1000, 4000, 16000, 64000 };
+    uint32_t full = (1UL << bits()) - 1;
+    float counts = HostSim::scriptValue("lux", 350) / ranges[regs[1] & 3] * (full + 1);
+    uint32_t data = counts > full ? full : (uint32_t) counts;
+    regs[2] = data & 0xFF;
+    regs[3] = data >> 8;
+  }
+
+  // Operation mode, Command-I bits 7:5: 0 power down, 1 ALS once, 5 ALS continuously
+  uint8_t mode() {
+    return regs[0] >> 5;
+  }
+
+  // The data registers hold the last finished integration, 0 until the first one
+  void update() {
+    if (!converting || HostSim::awakeMicros() < readyAt) return;
+    convert();
+    converting = false;
+    if (mode() == 5) start(); // next integration
+    else regs[0] &= 0x1F;     // once: back to power down
+  }
+
+  void write(const uint8_t *data, size_t length) {
+    update();
+    pointer = data[0] & 7;
+    for (size_t i = 1; i < length; i++) {
+      regs[pointer] = data[i];
+      if (pointer <= 1) {
+        if (mode() == 1 || mode() == 5) start();
+        else if (pointer == 0) converting = false;
+      }
+      pointer = (pointer + 1) & 7;
+    }
+  }
+
+  size_t read(uint8_t *buffer, size_t length) {
+    update();
+    for (size_t i = 0; i < length; i++) {
+      buffer[i] = regs[pointer];
+      pointer = (pointer + 1) & 7;
+    }
+    return length;
+  }
+};
+
+struct Pca9536 {
+  uint8_t pointer;
+  uint8_t regs[4];
+
+  void reset() {
+    pointer = 0;
+    regs[0] = 0xFF;
+    regs[1] = 0xFF;
+    regs[2] = 0x00;
+    regs[3] = 0xFF;
+  }
+
+  void write(const uint8_t *data, size_t length) {
+    pointer = data[0] & 3;
+    if (length > 1 && pointer > 0) regs[pointer] = data[1];
+    regs[0] = ((regs[1] & ~regs[3]) | regs[3]) ^ regs[2];
+  }
+
+  size_t read(uint8_t *buffer, size_t length) {
+    for (size_t i = 0; i < length; i++) buffer[i] = regs[pointer];
+    return length;
+  }
+};
+
+Mcp9800 temp;
+Mcp3221 soil;
+Isl29003 lux;
+Pca9536 gpio;
+
+uint32_t stretchLimitUs = 230; // default of the ESP8266 core
+uint32_t flakyCount = 0;
+
+// 0 if the device answers the transfer, else the error of Wire.endTransmission()
+uint8_t answer(uint8_t address) {
+  if (HostSim::scriptContains("absent", address)) return 2; // NACK on address
+  if (HostSim::scriptContains("stuck", address)) {
+    HostSim::advance(stretchLimitUs);
+    return 4;
+  }
+  if (HostSim::scriptContains("flaky", address) && flakyCount++ % 3 == 0) return 2;
+  return 0;
+}
+
+} // namespace
+
+namespace HostSim {
+
+void i2cReset() {
+  temp.reset();
+  lux.reset();
+  gpio.reset();
+}
+
+uint8_t i2cWrite(uint8_t address, const uint8_t *data, size_t length) {
+  stats().i2cTransactions++;
+  advance((length + 1) * HOST_I2C_BYTE_US);
+  uint8_t error = answer(address);
+  if (error) {
+    stats().i2cNacks++;
+    return error;
+  }
+  if (length == 0) return 0;
+  switch (address) {
+    case 0x48: temp.write(data, length); break;
+    case 0x44: lux.write(data, length); break;
+    case 0x41: gpio.write(data, length); break;
+    default: break;
+  }
+  return 0;
+}
+
+size_t i2cRead(uint8_t address, uint8_t *buffer, size_t length) {
+  stats().i2cTransactions++;
+  advance((length + 1) * HOST_I2C_BYTE_US);
+  if (answer(address)) {
+    stats().i2cNacks++;
+    return 0;
+  }
+  switch (address) {
+    case 0x48: return temp.read(buffer, length);
+    case 0x4D: return soil.read(buffer, length);
+    case 0x44: return lux.read(buffer, length);
+    case 0x41: return gpio.read(buffer, length);
+    default:   return 0;
+  }
+}
+
+} // namespace HostSim
+
+/////////////
+// TwoWire //
+/////////////
+
+void TwoWire::begin() {
+  _txLength = 0;
+  _rxLength = 0;
+  _rxIndex = 0;
+}
+
+void TwoWire::begin(int sda, int scl) {
+  (void) sda;
+  (void) scl;
+  begin();
+}
+
+void TwoWire::setClock(uint32_t frequency) {
+  (void) frequency;
+}
+
+void TwoWire::setClockStretchLimit(uint32_t limit) {
+  stretchLimitUs = limit;
+}
+
+void TwoWire::beginTransmission(uint8_t address) {
+  _txAddress = address;
+  _txLength = 0;
+}
+
+uint8_t TwoWire::endTransmission(uint8_t sendStop) {
+  (void) sendStop;
+  uint8_t result = HostSim::i2cWrite(_txAddress, _txBuffer, _txLength);
+  _txLength = 0;
+  return result;
+}
+
+size_t TwoWire::write(uint8_t data) {
+  if (_txLength >= BUFFER_LENGTH) return 0;
+  _txBuffer[_txLength++] = data;
+  return 1;
+}
+
+size_t TwoWire::write(const uint8_t *data, size_t quantity) {
+  size_t n = 0;
+  while (quantity--) n += write(*data++);
+  return n;
+}
+
+uint8_t TwoWire::requestFrom(uint8_t address, uint8_t quantity, uint8_t sendStop) {
+  (void) sendStop;
+  if (quantity > BUFFER_LENGTH) quantity = BUFFER_LENGTH;
+  _rxLength = HostSim::i2cRead(address, _rxBuffer, quantity);
+  _rxIndex = 0;
+  return _rxLength;
+}
+
+int TwoWire::available() {
+  return _rxLength - _rxIndex;
+}
+
+int TwoWire::read() {
+  return _rxIndex < _rxLength ? _rxBuffer[_rxIndex++] : -1;
+}
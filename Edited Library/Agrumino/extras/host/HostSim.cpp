@@ -0,0 +1,224 @@
+/*
+  HostSim.cpp - Simulation runtime of the Agrumino host build.
+  For details @see HostSim.h
+*/
+
+#include "HostSim.h"
+
+#include <string>
+#include <map>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+void setup();
+void loop();
+
+namespace HostSim {
+
+static const size_t RTC_USER_MEMORY = 512;
+
+static Stats simStats;
+static uint64_t bootMicros;        // Virtual awake time of the current wake-up
+static uint64_t rtcBase;           // Virtual RTC time at boot
+static uint32_t wakeIndex;
+static bool quiet;
+static std::map<std::string, std::vector<float> > script;
+static uint32_t rtcMemory[RTC_USER_MEMORY / 4];
+static char **bootArgv;
+
+static const char *env(const char *name, const char *fallback) {
+  const char *value = getenv(name);
+  return value && *value ? value : fallback;
+}
+
+static void loadState() {
+  const char *state = getenv("AGRUMINO_SIM_STATE");
+  if (state) {
+    unsigned long long rtc, awake, flashUs, wifiUs;
+    sscanf(state, "%u %llu %u %u %u %u %u %llu %llu %u %llu", &wakeIndex, &rtc,
+           &simStats.flashErases, &simStats.flashBytesProgrammed, &simStats.flashIllegalPrograms,
+           &simStats.i2cTransactions, &simStats.i2cNacks, &awake, &flashUs,
+           &simStats.wifiConnects, &wifiUs);
+    rtcBase = rtc;
+    simStats.awakeMicros = awake;
+    simStats.flashMicros = flashUs;
+    simStats.wifiMicros = wifiUs;
+  }
+  simStats.wakes = wakeIndex + 1;
+}
+
+static void loadScript() {
+  FILE *f = fopen(env("AGRUMINO_SIM_SCRIPT", "sensors.txt"), "r");
+  if (!f) return;
+  char line[512];
+  while (fgets(line, sizeof(line), f)) {
+    char *cursor = line;
+    char name[32];
+    int consumed;
+    if (line[0] == '#' || sscanf(cursor, "%31s%n", name, &consumed) != 1) continue;
+    cursor += consumed;
+    float value;
+    while (sscanf(cursor, "%f%n", &value, &consumed) == 1) {
+      script[name].push_back(value);
+      cursor += consumed;
+    }
+  }
+  fclose(f);
+}
+
+static float scriptValueAt(const char *name, float fallback, uint32_t wake) {
+  std::map<std::string, std::vector<float> >::const_iterator it = script.find(name);
+  if (it == script.end() || it->second.empty()) return fallback;
+  return it->second[wake % it->second.size()];
+}
+
+static void loadRtc() {
+  FILE *f = fopen(env("AGRUMINO_SIM_RTC", "agrumino_rtc.bin"), "rb");
+  if (f) {
+    if (fread(rtcMemory, 1, sizeof(rtcMemory), f) != sizeof(rtcMemory)) memset(rtcMemory, 0, sizeof(rtcMemory));
+    fclose(f);
+  }
+}
+
+static void saveRtc() {
+  FILE *f = fopen(env("AGRUMINO_SIM_RTC", "agrumino_rtc.bin"), "wb");
+  if (f) {
+    fwrite(rtcMemory, 1, sizeof(rtcMemory), f);
+    fclose(f);
+  }
+}
+
+static void printStats() {
+  fprintf(stderr,
+          "\n[sim] wakes=%u awake=%.1fms (%.1fms/wake) flash: erases=%u programmed=%uB illegal=%u time=%.1fms"
+          " i2c: transactions=%u nacks=%u wifi: connects=%u radio=%.1fms\n",
+          simStats.wakes, simStats.awakeMicros / 1000.0, simStats.awakeMicros / 1000.0 / simStats.wakes,
+          simStats.flashErases, simStats.flashBytesProgrammed, simStats.flashIllegalPrograms,
+          simStats.flashMicros / 1000.0, simStats.i2cTransactions, simStats.i2cNacks,
+          simStats.wifiConnects, simStats.wifiMicros / 1000.0);
+}
+
+void advance(uint64_t us) {
+  bootMicros += us;
+}
+
+uint64_t awakeMicros() {
+  return bootMicros;
+}
+
+uint64_t rtcMicros() {
+  return rtcBase + bootMicros;
+}
+
+double rtcPeriod() {
+  return scriptValue("rtcperiod", HOST_RTC_PERIOD_US);
+}
+
+// Real length of a deep sleep of us, counted in RTC ticks (see HostSim.h)
+static uint64_t sleepMicros(uint64_t us) {
+  double atSleep = rtcPeriod();
+  double atWake = scriptValueAt("rtcperiod", HOST_RTC_PERIOD_US, wakeIndex + 1);
+  double slept = us * (atSleep + atWake) / (2 * atSleep) * (1 + scriptValue("rtcdrift", 0) / 1e6);
+  return (uint64_t) slept + HOST_BOOT_US;
+}
+
+void deepSleep(uint64_t us) {
+  wifiOff();
+  flashSync();
+  saveRtc();
+  simStats.awakeMicros += bootMicros;
+  uint32_t wakes = strtoul(env("AGRUMINO_SIM_WAKES", "1"), NULL, 10);
+  if (wakeIndex + 1 >= wakes) {
+    printStats();
+    exit(0);
+  }
+  char state[256];
+  snprintf(state, sizeof(state), "%u %llu %u %u %u %u %u %llu %llu %u %llu", wakeIndex + 1,
+           (unsigned long long) (rtcMicros() + sleepMicros(us)), simStats.flashErases, simStats.flashBytesProgrammed,
+           simStats.flashIllegalPrograms, simStats.i2cTransactions, simStats.i2cNacks,
+           (unsigned long long) simStats.awakeMicros, (unsigned long long) simStats.flashMicros,
+           simStats.wifiConnects, (unsigned long long) simStats.wifiMicros);
+  setenv("AGRUMINO_SIM_STATE", state, 1);
+  fflush(stdout);
+  execv("/proc/self/exe", bootArgv);
+  perror("execv");
+  exit(1);
+}
+
+bool verbose() {
+  return !quiet;
+}
+
+Stats &stats() {
+  return simStats;
+}
+
+float scriptValue(const char *name, float fallback) {
+  return scriptValueAt(name, fallback, wakeIndex);
+}
+
+bool scriptContains(const char *name, float value) {
+  std::map<std::string, std::vector<float> >::const_iterator it = script.find(name);
+  if (it == script.end()) return false;
+  for (size_t i = 0; i < it->second.size(); i++) {
+    if (it->second[i] == value) return true;
+  }
+  return false;
+}
+
+int readInputPin(uint8_t pin) {
+  switch (pin) {
+    case 4:  return scriptValue("button", 0) ? LOW : HIGH;   // PIN_BTN_S1, active low
+    case 5:  return scriptValue("usb", 0) ? HIGH : LOW;      // PIN_USB_DETECT
+    case 13: return scriptValue("charging", 0) ? LOW : HIGH; // PIN_BATT_STAT, active low
+    default: return HIGH;
+  }
+}
+
+int readAdc() {
+  // Battery voltage through the R25/R26 divider, 10 bit over 0-1 V
+  float volt = scriptValue("battery", 3.9f);
+  int raw = (int) (volt * 424.0f / (1800.0f + 424.0f) * 1024.0f);
+  return constrain(raw, 0, 1023);
+}
+
+bool rtcRead(uint32_t offset, uint32_t *data, size_t size) {
+  if (offset * 4 + size > RTC_USER_MEMORY) return false;
+  memcpy(data, (uint8_t *) rtcMemory + offset * 4, size);
+  return true;
+}
+
+bool rtcWrite(uint32_t offset, uint32_t *data, size_t size) {
+  if (offset * 4 + size > RTC_USER_MEMORY) return false;
+  memcpy((uint8_t *) rtcMemory + offset * 4, data, size);
+  return true;
+}
+
+} // namespace HostSim
+
+int main(int argc, char **argv) {
+  (void) argc;
+  HostSim::bootArgv = argv;
+  HostSim::quiet = getenv("AGRUMINO_SIM_QUIET") != NULL;
+  HostSim::loadState();
+  HostSim::loadScript();
+  HostSim::loadRtc();
+  HostSim::flashOpen();
+  HostSim::i2cReset();
+
+  setup();
+  unsigned long loops = strtoul(HostSim::env("AGRUMINO_SIM_LOOPS", "100"), NULL, 10);
+  for (unsigned long i = 0; i < loops; i++) {
+    loop();
+  }
+  // The sketch never went to sleep: account the wake-up and stop here
+  HostSim::wifiOff();
+  HostSim::flashSync();
+  HostSim::saveRtc();
+  HostSim::simStats.awakeMicros += HostSim::bootMicros;
+  HostSim::printStats();
+  return 0;
+}
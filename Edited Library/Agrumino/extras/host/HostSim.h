@@ -0,0 +1,91 @@
+/*
+  HostSim.h - Simulation runtime of the Agrumino host build.
+
+  A run boots the sketch, calls setup() and then loop() until the sketch
+  enters deep sleep. Deep sleep re-executes the binary (so every global is
+  constructed again, exactly like a real wake-up) while the flash image and
+  the RTC user memory survive in files. The run stops after
+  AGRUMINO_SIM_WAKES wake-ups and prints the accumulated flash/I2C/time
+  statistics.
+
+  Environment:
+    AGRUMINO_SIM_WAKES   number of wake-ups to simulate (default 1)
+    AGRUMINO_SIM_LOOPS   max loop() calls per wake-up (default 100)
+    AGRUMINO_SIM_SCRIPT  sensor script (default sensors.txt)
+    AGRUMINO_SIM_FLASH   flash image (default agrumino_flash.bin)
+    AGRUMINO_SIM_RTC     RTC user memory image (default agrumino_rtc.bin)
+    AGRUMINO_SIM_QUIET   set to silence the sketch Serial output
+
+  The WiFi access point is scripted too (see HostWiFi.cpp).
+
+  The deep sleep lasts the time requested to the period of the RTC clock at
+  the sleep (system_rtc_clock_cali_proc()), the ticks are counted at the mean
+  of the periods of the sleep and of the wake-up (script key "rtcperiod", in
+  us), off by the script key "rtcdrift" (ppm), plus the boot.
+*/
+
+#ifndef HostSim_h
+#define HostSim_h
+
+#include "Arduino.h"
+
+// Modelled latencies (datasheet typicals of the parts on the board)
+#define HOST_FLASH_ERASE_US      45000 // 4 KB sector erase, GD25Q32 typ.
+#define HOST_FLASH_PAGE_US         700 // 256 B page program, GD25Q32 typ.
+#define HOST_FLASH_READ_US_PER_KB   25 // 40 MHz QIO read
+#define HOST_I2C_BYTE_US            90 // 100 kHz bus, 9 clocks per byte
+#define HOST_ADC_READ_US            80 // analogRead() on the ESP8266
+#define HOST_ADC_FAST_US             5 // A reading of system_adc_read_fast(), clock divider 8
+#define HOST_PIN_BOARD_POWER        15 // MOSFET of the sensors supply: the I2C devices are reset when it goes HIGH
+#define HOST_WIFI_SCAN_US      1560000 // Active scan of the 13 channels, 120 ms each
+#define HOST_WIFI_PROBE_US      120000 // Scan of a single known channel
+#define HOST_WIFI_ASSOC_US      250000 // Authentication, association and WPA2 handshake
+#define HOST_WIFI_DHCP_US      1000000 // DHCP discover/offer/request/ack
+#define HOST_BOOT_US            100000 // Deep sleep wake-up to setup(): ROM, boot loader and SDK init
+#define HOST_RTC_PERIOD_US         6.4 // RTC slow clock period, the script key "rtcperiod" changes it
+
+namespace HostSim {
+
+  struct Stats {
+    uint32_t wakes;
+    uint32_t flashErases;
+    uint32_t flashBytesProgrammed;
+    uint32_t flashIllegalPrograms; // 0→1 bit transitions attempted without an erase
+    uint32_t i2cTransactions;
+    uint32_t i2cNacks;
+    uint64_t awakeMicros;
+    uint64_t flashMicros;
+    uint32_t wifiConnects;
+    uint64_t wifiMicros;           // radio on time
+  };
+
+  void advance(uint64_t us);
+  uint64_t awakeMicros();
+  uint64_t rtcMicros();
+  double rtcPeriod();
+  void deepSleep(uint64_t us);
+
+  bool verbose();
+  Stats &stats();
+
+  // Sensor script: value of `name` for the current wake-up
+  float scriptValue(const char *name, float fallback);
+  bool scriptContains(const char *name, float value);
+
+  int readInputPin(uint8_t pin);
+  int readAdc();
+
+  bool rtcRead(uint32_t offset, uint32_t *data, size_t size);
+  bool rtcWrite(uint32_t offset, uint32_t *data, size_t size);
+
+  void flashOpen();
+  void flashSync();
+
+  void i2cReset();
+  uint8_t i2cWrite(uint8_t address, const uint8_t *data, size_t length);
+  size_t i2cRead(uint8_t address, uint8_t *buffer, size_t length);
+
+  void wifiOff();
+}
+
+#endif
@@ -0,0 +1,157 @@
+/*
+  HostWiFi.cpp - WiFi station of the host build, against a simulated access
+  point.
+
+  The access point answers on the channel of the script key "channel"
+  (default 6), with a BSSID ending with the script key "bssid" (default 1,
+  a new value is a new router) and not at all when the script key "wifi" is
+  0. A connect takes its typical time on the board:
+    - begin(ssid, password): scan of every channel, association, DHCP
+    - begin(ssid, password, channel, bssid): probe of that channel only,
+      association, DHCP; nothing found if the access point isn't there
+    - after config() with a static address: no DHCP
+  The radio is on from begin() to disconnect(true), mode(WIFI_OFF) or the
+  deep sleep, and its time is in the statistics.
+*/
+
+#include "HostSim.h"
+#include "ESP8266WiFi.h"
+
+extern "C" {
+#include "user_interface.h"
+}
+
+#define HOST_WIFI_SUBNET(last) IPAddress(192, 168, 1, last)
+
+ESP8266WiFiClass WiFi;
+
+namespace {
+
+WiFiMode_t wifiMode;
+bool radioOn;
+uint64_t radioOnAt;     // awakeMicros() of the radio power up
+bool dhcp = true;
+IPAddress staticIP, staticGateway, staticSubnet, staticDns;
+bool started;           // begin() called
+bool found;             // the access point answers to the last begin()
+uint64_t readyAt;       // awakeMicros() of the end of the last begin()
+bool counted;           // the connect has been counted in the statistics
+uint8_t apBssid[6];
+
+uint8_t apChannel() {
+  return (uint8_t) HostSim::scriptValue("channel", 6);
+}
+
+void radioPowerUp() {
+  if (!radioOn) {
+    radioOn = true;
+    radioOnAt = HostSim::awakeMicros();
+  }
+}
+
+} // namespace
+
+namespace HostSim {
+
+void wifiOff() {
+  if (radioOn) {
+    stats().wifiMicros += awakeMicros() - radioOnAt;
+    radioOn = false;
+  }
+  started = false;
+}
+
+} // namespace HostSim
+
+uint8_t wifi_get_opmode(void) {
+  return wifiMode;
+}
+
+bool ESP8266WiFiClass::mode(WiFiMode_t mode) {
+  wifiMode = mode;
+  if (mode == WIFI_OFF) {
+    HostSim::wifiOff();
+  }
+  return true;
+}
+
+bool ESP8266WiFiClass::config(IPAddress local, IPAddress gateway, IPAddress subnet, IPAddress dns1, IPAddress dns2) {
+  dhcp = !local && !gateway && !subnet;
+  staticIP = local;
+  staticGateway = gateway;
+  staticSubnet = subnet;
+  staticDns = dns1;
+  return true;
+}
+
+wl_status_t ESP8266WiFiClass::begin(const char *ssid, const char *passphrase, int32_t channel, const uint8_t *bssid, bool connect) {
+  if (wifiMode == WIFI_OFF) {
+    wifiMode = WIFI_STA;
+  }
+  radioPowerUp();
+  uint8_t router[6] = {0x02, 0xA6, 0x52, 0x00, 0x00, (uint8_t) HostSim::scriptValue("bssid", 1)};
+  memcpy(apBssid, router, sizeof(apBssid));
+  bool up = HostSim::scriptValue("wifi", 1) != 0;
+  uint64_t time;
+  if (channel > 0) {
+    found = up && channel == apChannel() && (!bssid || memcmp(bssid, apBssid, sizeof(apBssid)) == 0);
+    time = HOST_WIFI_PROBE_US;
+  } else {
+    found = up;
+    time = HOST_WIFI_SCAN_US;
+  }
+  if (found) {
+    time += HOST_WIFI_ASSOC_US + (dhcp ? HOST_WIFI_DHCP_US : 0);
+  }
+  readyAt = HostSim::awakeMicros() + time;
+  started = true;
+  counted = false;
+  return status();
+}
+
+bool ESP8266WiFiClass::disconnect(bool wifiOff) {
+  started = false;
+  if (wifiOff) {
+    HostSim::wifiOff();
+  }
+  return true;
+}
+
+wl_status_t ESP8266WiFiClass::status() {
+  if (!started) return WL_IDLE_STATUS;
+  if (HostSim::awakeMicros() < readyAt) return WL_DISCONNECTED;
+  if (!found) return WL_NO_SSID_AVAIL;
+  if (!counted) {
+    counted = true;
+    HostSim::stats().wifiConnects++;
+  }
+  return WL_CONNECTED;
+}
+
+uint8_t *ESP8266WiFiClass::BSSID() {
+  return apBssid;
+}
+
+int32_t ESP8266WiFiClass::channel() {
+  return apChannel();
+}
+
+IPAddress ESP8266WiFiClass::localIP() {
+  if (status() != WL_CONNECTED) return IPAddress();
+  return dhcp ? HOST_WIFI_SUBNET(100) : staticIP;
+}
+
+IPAddress ESP8266WiFiClass::gatewayIP() {
+  if (status() != WL_CONNECTED) return IPAddress();
+  return dhcp ? HOST_WIFI_SUBNET(1) : staticGateway;
+}
+
+IPAddress ESP8266WiFiClass::subnetMask() {
+  if (status() != WL_CONNECTED) return IPAddress();
+  return dhcp ? IPAddress(255, 255, 255, 0) : staticSubnet;
+}
+
+IPAddress ESP8266WiFiClass::dnsIP(uint8_t dnsNo) {
+  if (status() != WL_CONNECTED || dnsNo > 0) return IPAddress();
+  return dhcp ? HOST_WIFI_SUBNET(1) : staticDns;
+}
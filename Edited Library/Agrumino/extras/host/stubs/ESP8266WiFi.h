@@ -0,0 +1,57 @@
+/*
+  ESP8266WiFi.h - Host stub of the ESP8266 WiFi station: a simulated access
+  point with the connect times of the radio (see HostWiFi.cpp). Only the
+  station calls used by the library and the sketches are declared.
+*/
+
+#ifndef ESP8266WiFi_h
+#define ESP8266WiFi_h
+
+#include "Arduino.h"
+#include "WiFiClient.h"
+
+typedef enum {
+  WL_IDLE_STATUS     = 0,
+  WL_NO_SSID_AVAIL   = 1,
+  WL_SCAN_COMPLETED  = 2,
+  WL_CONNECTED       = 3,
+  WL_CONNECT_FAILED  = 4,
+  WL_CONNECTION_LOST = 5,
+  WL_DISCONNECTED    = 6
+} wl_status_t;
+
+typedef enum {
+  WIFI_OFF = 0, WIFI_STA = 1, WIFI_AP = 2, WIFI_AP_STA = 3
+} WiFiMode_t;
+
+class IPAddress {
+  public:
+    IPAddress() : _address(0) {}
+    IPAddress(uint32_t address) : _address(address) {}
+    IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d) : _address(a | (b << 8) | (c << 16) | ((uint32_t) d << 24)) {}
+    operator uint32_t() const { return _address; }
+    uint8_t operator[](int index) const { return _address >> (index * 8); }
+
+  private:
+    uint32_t _address; // Network order, like lwIP
+};
+
+class ESP8266WiFiClass {
+  public:
+    bool mode(WiFiMode_t mode);
+    void persistent(bool persistent) {}
+    bool config(IPAddress local, IPAddress gateway, IPAddress subnet, IPAddress dns1 = (uint32_t) 0, IPAddress dns2 = (uint32_t) 0);
+    wl_status_t begin(const char *ssid, const char *passphrase = NULL, int32_t channel = 0, const uint8_t *bssid = NULL, bool connect = true);
+    bool disconnect(bool wifiOff = false);
+    wl_status_t status();
+    uint8_t *BSSID();
+    int32_t channel();
+    IPAddress localIP();
+    IPAddress gatewayIP();
+    IPAddress subnetMask();
+    IPAddress dnsIP(uint8_t dnsNo = 0);
+};
+
+extern ESP8266WiFiClass WiFi;
+
+#endif
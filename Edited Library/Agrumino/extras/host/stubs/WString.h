@@ -0,0 +1,42 @@
+/*
+  WString.h - Host stub of the Arduino String class, backed by std::string.
+*/
+
+#ifndef WString_h
+#define WString_h
+
+#include <string>
+#include <stddef.h>
+
+class String {
+  public:
+    String() {}
+    String(const char *cstr) : _str(cstr ? cstr : "") {}
+    String(const std::string &str) : _str(str) {}
+    String(char c) : _str(1, c) {}
+    String(int value, unsigned char base = 10);
+    String(unsigned int value, unsigned char base = 10);
+    String(long value, unsigned char base = 10);
+    String(unsigned long value, unsigned char base = 10);
+    String(float value, unsigned char decimalPlaces = 2);
+    String(double value, unsigned char decimalPlaces = 2);
+
+    unsigned int length() const { return _str.length(); }
+    const char *c_str() const { return _str.c_str(); }
+    char operator[](unsigned int index) const { return _str[index]; }
+
+    String &operator+=(const String &rhs) { _str += rhs._str; return *this; }
+    String &operator+=(const char *rhs) { _str += rhs; return *this; }
+    String &operator+=(char rhs) { _str += rhs; return *this; }
+    bool operator==(const String &rhs) const { return _str == rhs._str; }
+    bool operator!=(const String &rhs) const { return _str != rhs._str; }
+
+    friend String operator+(const String &lhs, const String &rhs) { return String(lhs._str + rhs._str); }
+    friend String operator+(const String &lhs, const char *rhs) { return String(lhs._str + rhs); }
+    friend String operator+(const char *lhs, const String &rhs) { return String(lhs + rhs._str); }
+
+  private:
+    std::string _str;
+};
+
+#endif
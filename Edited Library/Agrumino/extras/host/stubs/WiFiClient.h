@@ -0,0 +1,39 @@
+/*
+  WiFiClient.h - Host stub of the ESP8266 WiFiClient: a plain TCP socket,
+  so the uploaders can talk to a server on localhost (see HostClient.cpp).
+*/
+
+#ifndef WiFiClient_h
+#define WiFiClient_h
+
+#include "Client.h"
+
+class WiFiClient : public Client {
+  public:
+    WiFiClient();
+    ~WiFiClient();
+
+    int connect(const char *host, uint16_t port) override;
+    size_t write(uint8_t c) override;
+    size_t write(const uint8_t *buffer, size_t size) override;
+    using Print::write;
+    int available() override;
+    int read() override;
+    int read(uint8_t *buffer, size_t size) override;
+    int peek() override;
+    void flush() override {}
+    void stop() override;
+    uint8_t connected() override;
+    operator bool() override { return connected(); }
+
+  private:
+    bool fill();
+
+    int _fd;
+    bool _eof;
+    uint8_t _buffer[512];
+    size_t _start;
+    size_t _end;
+};
+
+#endif
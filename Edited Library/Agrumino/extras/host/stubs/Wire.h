@@ -0,0 +1,41 @@
+/*
+  Wire.h - Host stub of the TwoWire I2C master. Transactions are routed to
+  the simulated device models in HostI2C.cpp.
+*/
+
+#ifndef TwoWire_h
+#define TwoWire_h
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define BUFFER_LENGTH 32
+
+class TwoWire {
+  public:
+    void begin();
+    void begin(int sda, int scl);
+    void setClock(uint32_t frequency);
+    void setClockStretchLimit(uint32_t limit);
+    void beginTransmission(uint8_t address);
+    void beginTransmission(int address) { beginTransmission((uint8_t) address); }
+    uint8_t endTransmission(uint8_t sendStop = 1);
+    size_t write(uint8_t data);
+    size_t write(const uint8_t *data, size_t quantity);
+    uint8_t requestFrom(uint8_t address, uint8_t quantity, uint8_t sendStop = 1);
+    uint8_t requestFrom(int address, int quantity) { return requestFrom((uint8_t) address, (uint8_t) quantity); }
+    int available();
+    int read();
+
+  private:
+    uint8_t _txAddress;
+    uint8_t _txBuffer[BUFFER_LENGTH];
+    size_t _txLength;
+    uint8_t _rxBuffer[BUFFER_LENGTH];
+    size_t _rxLength;
+    size_t _rxIndex;
+};
+
+extern TwoWire Wire;
+
+#endif
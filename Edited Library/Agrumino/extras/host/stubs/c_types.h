@@ -0,0 +1 @@
+/* c_types.h - empty host stub, see spi_flash.h */
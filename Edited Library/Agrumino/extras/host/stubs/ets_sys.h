@@ -0,0 +1 @@
+/* ets_sys.h - empty host stub, see spi_flash.h */
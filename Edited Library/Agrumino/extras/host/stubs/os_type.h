@@ -0,0 +1 @@
+/* os_type.h - empty host stub, see spi_flash.h */
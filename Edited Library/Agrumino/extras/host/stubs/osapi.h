@@ -0,0 +1 @@
+/* osapi.h - empty host stub, see spi_flash.h */
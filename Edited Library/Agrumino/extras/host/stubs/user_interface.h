@@ -0,0 +1,21 @@
+/*
+  user_interface.h - Host stub of the ESP8266 SDK system API: only the
+  calibration of the RTC clock, from the sensor script (see HostSim.h), the
+  fast ADC read and the WiFi mode.
+*/
+
+#ifndef USER_INTERFACE_H
+#define USER_INTERFACE_H
+
+#include <stdint.h>
+
+#define NULL_MODE       0x00
+#define STATION_MODE    0x01
+#define SOFTAP_MODE     0x02
+#define STATIONAP_MODE  0x03
+
+uint32_t system_rtc_clock_cali_proc(void);
+void system_adc_read_fast(uint16_t *adc_addr, uint16_t adc_num, uint8_t adc_clk_div);
+uint8_t wifi_get_opmode(void);
+
+#endif
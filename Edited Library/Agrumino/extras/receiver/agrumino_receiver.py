@@ -0,0 +1,186 @@
+#!/usr/bin/env python3
+"""Reference receiver of the Agrumino binary uploads (see AgruminoFrames.h).
+
+Serves HTTP on localhost and decodes the frames POSTed by AgruminoFrames
+into CSV or JSON lines:
+
+    python3 agrumino_receiver.py                    # port 8080, CSV on stdout
+    python3 agrumino_receiver.py --port 9000 --json --out samples.jsonl
+
+or decodes frames saved to a file:
+
+    python3 agrumino_receiver.py --decode upload.bin
+
+Every frame is checked (magic, version, length, CRC-32). A request with a
+bad frame is answered 400 and none of its records is written; a good one
+200 with {"frames": n, "records": n}. A batch uploaded twice (same device,
+generation and first index) is acknowledged but not written again.
+
+The samples carry the device clock of their reading (device_time) and the
+version 2 frames the device clock of the upload: a sample is dated (time,
+UTC) at the time the frame was received less the difference of the two.
+Saved frames are dated from the modification time of the file.
+"""
+
+import argparse
+import csv
+import json
+import os
+import struct
+import sys
+import time
+import zlib
+from datetime import datetime, timezone
+from http.server import BaseHTTPRequestHandler, HTTPServer
+
+MAGIC = b"AGRF"
+# magic, version, type, record size, count, device, generation, first (and clock, from version 2)
+HEADERS = {1: struct.Struct("<4sBBHHIHH"), 2: struct.Struct("<4sBBHHIHHI")}
+CRC = struct.Struct("<I")
+
+TYPE_RAW = 0
+TYPE_SAMPLE = 1
+
+# AgruminoSample (AgruminoRecord.h), packed, by record size: the time was added later
+SAMPLE_FIELDS = ("isAttachedToUSB", "isBatteryCharging", "isButtonPressed", "temperature",
+                 "soilMoisture", "illuminance", "batteryVoltage", "batteryLevel", "device_time")
+SAMPLES = {20: struct.Struct("<???ffffB"), 24: struct.Struct("<???ffffBI")}
+COLUMNS = ("device", "generation", "index", "time") + SAMPLE_FIELDS + ("raw",)
+
+
+class FrameError(ValueError):
+    pass
+
+
+def decode_frames(data, received=None):
+    """Returns the number of frames in data and their records, as dicts.
+    received is the unix time the frames were received at, now if None."""
+    if received is None:
+        received = time.time()
+    frames = 0
+    records = []
+    offset = 0
+    while offset < len(data):
+        if len(data) - offset < 5 or data[offset:offset + 4] != MAGIC or data[offset + 4] not in HEADERS:
+            raise FrameError("bad magic/version at byte %d" % offset)
+        header = HEADERS[data[offset + 4]]
+        if len(data) - offset < header.size + CRC.size:
+            raise FrameError("truncated frame header at byte %d" % offset)
+        fields = header.unpack_from(data, offset)
+        magic, version, kind, record_size, count, device, generation, first = fields[:8]
+        clock = fields[8] if len(fields) > 8 else None
+        if record_size == 0:
+            raise FrameError("record size 0 at byte %d" % offset)
+        end = offset + header.size + count * record_size
+        if end + CRC.size > len(data):
+            raise FrameError("truncated frame at byte %d" % offset)
+        (crc,) = CRC.unpack_from(data, end)
+        if zlib.crc32(data[offset:end]) != crc:
+            raise FrameError("bad CRC at byte %d" % offset)
+
+        payload = data[offset + header.size:end]
+        for i in range(count):
+            record = payload[i * record_size:(i + 1) * record_size]
+            row = {"device": device, "generation": generation, "index": first + i}
+            if kind == TYPE_SAMPLE and record_size in SAMPLES:
+                values = SAMPLES[record_size].unpack(record)
+                # floats were 32 bits on the board: drop the digits added by the conversion
+                row.update(zip(SAMPLE_FIELDS, (float("%.7g" % v) if isinstance(v, float) else v for v in values)))
+                if clock and row.get("device_time"):
+                    row["time"] = iso_time(received - ((clock - row["device_time"]) & 0xFFFFFFFF))
+            else:
+                row["raw"] = record.hex()
+            records.append(row)
+        offset = end + CRC.size
+        frames += 1
+    return frames, records
+
+
+def iso_time(timestamp):
+    return datetime.fromtimestamp(int(timestamp), timezone.utc).strftime("%Y-%m-%dT%H:%M:%SZ")
+
+
+class Output:
+    def __init__(self, stream, as_json):
+        self.stream = stream
+        self.as_json = as_json
+        self.seen = set()
+        self.writer = None if as_json else csv.DictWriter(stream, COLUMNS, extrasaction="ignore")
+        if self.writer and not (stream.seekable() and stream.tell() > 0):
+            self.writer.writeheader()
+
+    def write(self, records):
+        written = 0
+        for row in records:
+            key = (row["device"], row["generation"], row["index"])
+            if key in self.seen:
+                continue
+            self.seen.add(key)
+            if self.as_json:
+                self.stream.write(json.dumps(row) + "\n")
+            else:
+                self.writer.writerow(row)
+            written += 1
+        self.stream.flush()
+        return written
+
+
+def serve(host, port, path, output):
+    class Handler(BaseHTTPRequestHandler):
+        protocol_version = "HTTP/1.1"  # keep-alive, like the uploader
+
+        def do_POST(self):
+            if self.path != path:
+                return self.reply(404, {"error": "unknown path"})
+            length = int(self.headers.get("Content-Length", 0))
+            data = self.rfile.read(length)
+            try:
+                frames, records = decode_frames(data, time.time())
+            except FrameError as error:
+                return self.reply(400, {"error": str(error)})
+            written = output.write(records)
+            self.reply(200, {"frames": frames, "records": len(records), "new": written})
+
+        def reply(self, status, body):
+            payload = json.dumps(body).encode()
+            self.send_response(status)
+            self.send_header("Content-Type", "application/json")
+            self.send_header("Content-Length", str(len(payload)))
+            self.end_headers()
+            self.wfile.write(payload)
+
+        def log_message(self, fmt, *args):
+            sys.stderr.write("[receiver] " + (fmt % args) + "\n")
+
+    server = HTTPServer((host, port), Handler)
+    sys.stderr.write("[receiver] listening on http://%s:%d%s\n" % (host, port, path))
+    server.serve_forever()
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--host", default="127.0.0.1")
+    parser.add_argument("--port", type=int, default=8080)
+    parser.add_argument("--path", default="/agrumino")
+    parser.add_argument("--json", action="store_true", help="JSON lines instead of CSV")
+    parser.add_argument("--out", help="append the records to this file instead of stdout")
+    parser.add_argument("--decode", metavar="FILE", help="decode a file of frames and exit")
+    args = parser.parse_args()
+
+    stream = open(args.out, "a", newline="") if args.out else sys.stdout
+    output = Output(stream, args.json)
+    if args.decode:
+        with open(args.decode, "rb") as f:
+            try:
+                output.write(decode_frames(f.read(), os.path.getmtime(args.decode))[1])
+            except FrameError as error:
+                sys.exit("agrumino_receiver: %s" % error)
+        return
+    try:
+        serve(args.host, args.port, args.path, output)
+    except KeyboardInterrupt:
+        pass
+
+
+if __name__ == "__main__":
+    main()
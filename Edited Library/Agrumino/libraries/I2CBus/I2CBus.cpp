@@ -0,0 +1,151 @@
+/*
+  I2CBus.cpp - Bounded, retried I2C transactions shared by the Agrumino drivers
+  For details @see I2CBus.h
+*/
+
+#include "I2CBus.h"
+
+I2CBus i2cBus;
+
+I2CBus::I2CBus()
+: _timeout(I2C_BUS_DEFAULT_TIMEOUT_US)
+, _retries(I2C_BUS_DEFAULT_RETRIES)
+, _backoff(I2C_BUS_DEFAULT_BACKOFF_US)
+{
+  resetStats();
+}
+
+void I2CBus::begin(int sda, int scl) {
+  Wire.begin(sda, scl);
+  Wire.setClockStretchLimit(_timeout);
+}
+
+// Longest clock stretching accepted from a device, in microseconds
+void I2CBus::setTimeout(uint32_t micros) {
+  _timeout = micros;
+  Wire.setClockStretchLimit(_timeout);
+}
+
+// Retries of a failed transaction, with a pause of backoffMicros before the
+// first one, doubled before each of the next ones. 0 retries: fail at once
+void I2CBus::setRetries(uint8_t retries, uint16_t backoffMicros) {
+  _retries = retries;
+  _backoff = backoffMicros;
+}
+
+// I2C_BUS_OK if a device answers at address
+uint8_t I2CBus::ping(uint8_t address) {
+  return transfer(address, -1, NULL, NULL, 0, false);
+}
+
+// Writes length bytes (maybe 0, to only set the register pointer) to reg
+uint8_t I2CBus::write(uint8_t address, uint8_t reg, const uint8_t *data, size_t length) {
+  return transfer(address, reg, data, NULL, length, false);
+}
+
+// Reads length bytes from reg. A NULL buffer discards them. On failure the
+// buffer is left unchanged
+uint8_t I2CBus::read(uint8_t address, uint8_t reg, uint8_t *buffer, size_t length) {
+  return transfer(address, reg, NULL, buffer, length, true);
+}
+
+// Reads length bytes from a device without registers (e.g. the MCP3221)
+uint8_t I2CBus::receive(uint8_t address, uint8_t *buffer, size_t length) {
+  return transfer(address, -1, NULL, buffer, length, true);
+}
+
+// Counters of the device at address (all 0 if it was never used)
+I2CDeviceStats I2CBus::stats(uint8_t address) {
+  I2CDeviceStats *stats = device(address, false);
+  if (stats) {
+    return *stats;
+  }
+  I2CDeviceStats none;
+  memset(&none, 0, sizeof(none));
+  none.address = address;
+  return none;
+}
+
+// Failed transactions of all the devices
+uint32_t I2CBus::failures() {
+  uint32_t failures = 0;
+  for (uint8_t i = 0; i < I2C_BUS_MAX_DEVICES; i++) {
+    failures += _devices[i].failures;
+  }
+  return failures;
+}
+
+void I2CBus::resetStats() {
+  memset(_devices, 0, sizeof(_devices));
+}
+
+uint8_t I2CBus::transfer(uint8_t address, int reg, const uint8_t *data, uint8_t *buffer, size_t length, bool reading) {
+  uint8_t result = attempt(address, reg, data, buffer, length, reading);
+  I2CDeviceStats *stats = device(address, true);
+  for (uint8_t retry = 0; result != I2C_BUS_OK && retry < _retries; retry++) {
+    if (stats) {
+      stats->retries++;
+    }
+    delayMicroseconds((uint32_t) _backoff << retry);
+    result = attempt(address, reg, data, buffer, length, reading);
+  }
+  if (stats) {
+    stats->transactions++;
+    stats->lastError = result;
+    if (result != I2C_BUS_OK) {
+      stats->failures++;
+    }
+  }
+  return result;
+}
+
+// A single try: writes reg (if >= 0) and data, or reads into buffer after
+// setting the register pointer to reg (if >= 0)
+uint8_t I2CBus::attempt(uint8_t address, int reg, const uint8_t *data, uint8_t *buffer, size_t length, bool reading) {
+  if (reg >= 0 || !reading) {
+    Wire.beginTransmission(address);
+    if (reg >= 0) {
+      Wire.write((uint8_t) reg);
+    }
+    if (!reading && length > 0 && Wire.write(data, length) != length) {
+      Wire.endTransmission();
+      return I2C_BUS_TOO_LONG;
+    }
+    uint8_t result = Wire.endTransmission();
+    if (result != I2C_BUS_OK || !reading) {
+      return result;
+    }
+  }
+
+  if (length > BUFFER_LENGTH) {
+    return I2C_BUS_TOO_LONG;
+  }
+  size_t received = Wire.requestFrom(address, (uint8_t) length);
+  if (received != length) {
+    while (Wire.available()) {
+      Wire.read();
+    }
+    return I2C_BUS_SHORT_READ;
+  }
+  for (size_t i = 0; i < length; i++) {
+    uint8_t value = Wire.read();
+    if (buffer) {
+      buffer[i] = value;
+    }
+  }
+  return I2C_BUS_OK;
+}
+
+// Counters of a device, added (if add) on its first transaction. NULL if missing or the table is full
+I2CDeviceStats *I2CBus::device(uint8_t address, bool add) {
+  for (uint8_t i = 0; i < I2C_BUS_MAX_DEVICES; i++) {
+    if (_devices[i].address == address) {
+      return &_devices[i];
+    }
+    if (_devices[i].address == 0 && add) {
+      _devices[i].address = address;
+      return &_devices[i];
+    }
+  }
+  return NULL;
+}
@@ -0,0 +1,80 @@
+/*
+  I2CBus.h - Bounded, retried I2C transactions shared by the Agrumino drivers
+  Created for the AgruminoFlash project.
+
+  Every transaction of the bundled drivers (MCP9800, MCP3221, PCA9536,
+  ISL29003) goes through I2CBus, that:
+    - bounds the time of a transaction: the clock stretching of a device is
+      limited (setTimeout()) and nobody waits for bytes that didn't come
+    - retries a failed transaction, doubling the pause every time
+      (setRetries()), so a glitch doesn't make a probe miss a sensor
+    - counts, per device, the transactions, the retried attempts and the
+      transactions that failed even after the retries (stats())
+  The worst case of a transaction is (retries + 1) times its bus time plus
+  the timeout, plus the pauses: about 4 ms with the defaults, so a stuck
+  sensor can't keep the board (and maybe the radio) awake until the watchdog.
+
+  Example:
+    uint8_t config;
+    if (i2cBus.read(0x48, 0x01, &config, 1) != I2C_BUS_OK)
+      Serial.println(i2cBus.stats(0x48).failures);
+*/
+
+#ifndef I2CBus_h
+#define I2CBus_h
+
+#include <Arduino.h>
+#include <Wire.h>
+
+// Results: 1-4 are the ones of Wire.endTransmission()
+#define I2C_BUS_OK                  0
+#define I2C_BUS_TOO_LONG            1 // More data than the Wire buffer
+#define I2C_BUS_NACK_ADDRESS        2 // No device at the address
+#define I2C_BUS_NACK_DATA           3
+#define I2C_BUS_ERROR               4 // Bus busy or clock stretching longer than the timeout
+#define I2C_BUS_SHORT_READ          5 // The device sent less bytes than requested
+
+#define I2C_BUS_MAX_DEVICES         8
+#define I2C_BUS_DEFAULT_TIMEOUT_US  1000 // Clock stretching limit
+#define I2C_BUS_DEFAULT_RETRIES     2
+#define I2C_BUS_DEFAULT_BACKOFF_US  200  // Pause before the first retry, doubled before each of the next ones
+
+struct I2CDeviceStats {
+  uint8_t address;
+  uint8_t lastError;     // Result of the last transaction
+  uint16_t transactions;
+  uint16_t retries;      // Failed attempts that were retried
+  uint16_t failures;     // Transactions failed after all the retries
+};
+
+class I2CBus {
+public:
+  I2CBus();
+
+  void begin(int sda, int scl);
+  void setTimeout(uint32_t micros);
+  void setRetries(uint8_t retries, uint16_t backoffMicros);
+
+  uint8_t ping(uint8_t address);
+  uint8_t write(uint8_t address, uint8_t reg, const uint8_t *data, size_t length);
+  uint8_t read(uint8_t address, uint8_t reg, uint8_t *buffer, size_t length);
+  uint8_t receive(uint8_t address, uint8_t *buffer, size_t length);
+
+  I2CDeviceStats stats(uint8_t address);
+  uint32_t failures();
+  void resetStats();
+
+protected:
+  uint8_t transfer(uint8_t address, int reg, const uint8_t *data, uint8_t *buffer, size_t length, bool reading);
+  uint8_t attempt(uint8_t address, int reg, const uint8_t *data, uint8_t *buffer, size_t length, bool reading);
+  I2CDeviceStats *device(uint8_t address, bool add);
+
+  uint32_t _timeout;
+  uint8_t _retries;
+  uint16_t _backoff;
+  I2CDeviceStats _devices[I2C_BUS_MAX_DEVICES];
+};
+
+extern I2CBus i2cBus;
+
+#endif
@@ -0,0 +1,226 @@
+/*
+  ISL29003.cpp - Driver of the ISL29003 ambient light sensor
+  For details @see ISL29003.h
+*/
+
+#include "ISL29003.h"
+
+static const uint32_t ISL29003_TYPICAL_US[4] = {90000, 5630, 352, 22};
+static const float ISL29003_RANGE_LUX[4] = {1000, 4000, 16000, 64000};
+
+ISL29003::ISL29003(uint8_t address)
+: _address(address)
+, _command2(0)
+, _command2Valid(false)
+, _resolution(ISL29003_RES_16)
+, _range(ISL29003_RANGE_1000)
+, _autoRange(false)
+, _minCounts(0)
+, _minLux(0)
+, _phase(ISL29003_IDLE)
+, _converting(ISL29003_RES_16)
+, _startedAt(0)
+, _duration(0)
+, _conversions(0)
+, _step(0)
+, _counts(0)
+, _lux(0)
+, _error(I2C_BUS_OK)
+{
+}
+
+// The sensor has just been powered: its registers hold the defaults, powered
+// down. No I2C traffic
+void ISL29003::powerUp() {
+  _command2 = 0;
+  _command2Valid = true;
+  _phase = ISL29003_IDLE;
+}
+
+// Forgets the shadow of Command-II and the measurement in progress (e.g. the
+// sensor lost the power): the next start() writes the registers again
+void ISL29003::invalidate() {
+  _command2Valid = false;
+  _phase = ISL29003_IDLE;
+}
+
+// Stops a conversion in progress. Not needed after a measurement: the sensor
+// powers down by itself after each conversion
+uint8_t ISL29003::powerDown() {
+  const uint8_t mode = ISL29003_MODE_POWER_DOWN;
+  _phase = ISL29003_IDLE;
+  return i2cBus.write(_address, ISL29003_REG_COMMAND_1, &mode, 1);
+}
+
+// Fixed resolution of the measurements, and no precision
+void ISL29003::setResolution(isl29003_resolution_t resolution) {
+  _resolution = resolution;
+  _minCounts = 0;
+}
+
+// Range of the next measurement; with the auto-ranging, the one it starts from
+void ISL29003::setRange(isl29003_range_t range) {
+  _range = range;
+}
+
+void ISL29003::setAutoRange(bool enabled) {
+  _autoRange = enabled;
+}
+
+// Precision of a reading, relative (e.g. 1.0 for 1%) or a step of minLux,
+// whichever is coarser: in the dark 1% would take 16 bits for nothing. The
+// resolution is picked by every measurement (an 8 bit probe first). 0 goes
+// back to the resolution of setResolution()
+void ISL29003::setPrecision(float percent, float minLux) {
+  _minLux = minLux;
+  if (percent <= 0) {
+    _minCounts = 0;
+    return;
+  }
+  float counts = ceilf(100.0f / percent);
+  _minCounts = counts > 65535.0f ? 65535 : (uint16_t) counts;
+}
+
+// Starts a measurement. Returns false if the sensor can't be reached: the
+// next poll() ends the measurement with the error
+bool ISL29003::start() {
+  _conversions = 0;
+  _step = 0;
+  _phase = _minCounts ? ISL29003_PROBING : ISL29003_CONVERTING;
+  if (!convert(_minCounts ? ISL29003_RES_8 : _resolution)) {
+    _phase = ISL29003_DONE;
+    return false;
+  }
+  return true;
+}
+
+// Carries on the measurement started by start(): true once, when it is over
+// (getLux(), getError()). Before the end of a conversion returns false at once
+bool ISL29003::poll() {
+  if (_phase == ISL29003_DONE) {
+    _phase = ISL29003_IDLE;
+    return true;
+  }
+  if (_phase == ISL29003_IDLE || getWaitMicros() > 0) {
+    return false;
+  }
+
+  uint16_t counts;
+  uint8_t result = readCounts(counts);
+  if (result != I2C_BUS_OK) {
+    return finish(result);
+  }
+
+  if (_autoRange && _conversions < ISL29003_MAX_CONVERSIONS) {
+    uint16_t full = fullScale(_converting);
+    if (counts >= full && _range < ISL29003_RANGE_64000 && _step >= 0) {
+      _range = (isl29003_range_t) (_range + 1);
+      _step = 1;
+      return convert(_converting) ? false : finish(_error);
+    }
+    if (counts < full / 5 && _range > ISL29003_RANGE_1000 && _step <= 0) {
+      _range = (isl29003_range_t) (_range - 1);
+      _step = -1;
+      return convert(_converting) ? false : finish(_error);
+    }
+  }
+
+  if (_phase == ISL29003_PROBING) {
+    isl29003_resolution_t resolution = ISL29003_RES_8;
+    while (resolution > ISL29003_RES_16 && !isPrecise(counts, resolution)) {
+      resolution = (isl29003_resolution_t) (resolution - 1);
+    }
+    if (resolution != ISL29003_RES_8) {
+      _phase = ISL29003_CONVERTING;
+      return convert(resolution) ? false : finish(_error);
+    }
+  }
+
+  _counts = counts;
+  _lux = ISL29003_RANGE_LUX[_range] * counts / (fullScale(_converting) + 1.0f);
+  return finish(I2C_BUS_OK);
+}
+
+// A whole measurement. 0 lux if it failed (getError())
+float ISL29003::read() {
+  start();
+  while (!poll()) {
+    waitConversion();
+  }
+  return _lux;
+}
+
+// Waits for the end of the conversion in progress
+void ISL29003::waitConversion() {
+  uint32_t wait = getWaitMicros();
+  if (wait >= 1000) {
+    delay(wait / 1000);
+    wait %= 1000;
+  }
+  if (wait) {
+    delayMicroseconds(wait);
+  }
+}
+
+// Microseconds left of the conversion in progress, 0 if poll() can go on
+uint32_t ISL29003::getWaitMicros() {
+  if (_phase != ISL29003_PROBING && _phase != ISL29003_CONVERTING) {
+    return 0;
+  }
+  uint32_t elapsed = micros() - _startedAt;
+  return elapsed < _duration ? _duration - elapsed : 0;
+}
+
+// Integration time at resolution, with the margin of the internal clock
+uint32_t ISL29003::conversionMicros(isl29003_resolution_t resolution) {
+  uint32_t typical = ISL29003_TYPICAL_US[resolution];
+  return typical + typical * ISL29003_MARGIN_PERCENT / 100;
+}
+
+// Starts a conversion at resolution on _range: Command-II only if it changed
+bool ISL29003::convert(isl29003_resolution_t resolution) {
+  uint8_t command2 = (resolution << 2) | _range;
+  uint8_t result = I2C_BUS_OK;
+  if (!_command2Valid || command2 != _command2) {
+    result = i2cBus.write(_address, ISL29003_REG_COMMAND_2, &command2, 1);
+    _command2Valid = result == I2C_BUS_OK;
+    _command2 = command2;
+  }
+  if (result == I2C_BUS_OK) {
+    const uint8_t mode = ISL29003_MODE_ALS_ONCE;
+    result = i2cBus.write(_address, ISL29003_REG_COMMAND_1, &mode, 1);
+  }
+  _error = result;
+  _converting = resolution;
+  _conversions++;
+  _startedAt = micros();
+  _duration = conversionMicros(resolution);
+  return result == I2C_BUS_OK;
+}
+
+// True if a conversion at resolution gives the precision, from the counts of
+// the 8 bit probe (16 times more for every 4 bits more)
+bool ISL29003::isPrecise(uint16_t probeCounts, isl29003_resolution_t resolution) {
+  uint8_t extraBits = 4 * (ISL29003_RES_8 - resolution);
+  return ((uint32_t) probeCounts << extraBits) >= _minCounts
+      || ISL29003_RANGE_LUX[_range] / (fullScale(resolution) + 1.0f) <= _minLux;
+}
+
+bool ISL29003::finish(uint8_t error) {
+  _error = error;
+  if (error != I2C_BUS_OK) {
+    _counts = 0;
+    _lux = 0;
+  }
+  _phase = ISL29003_IDLE;
+  return true;
+}
+
+uint8_t ISL29003::readCounts(uint16_t &counts) {
+  uint8_t bytes[2];
+  uint8_t result = i2cBus.read(_address, ISL29003_REG_DATA, bytes, 2);
+  if (result == I2C_BUS_OK) {
+    counts = (bytes[1] << 8) | bytes[0];
+  }
+  return result;
+}
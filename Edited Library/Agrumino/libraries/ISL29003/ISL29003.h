@@ -0,0 +1,123 @@
+/*
+  ISL29003.h - Driver of the ISL29003 ambient light sensor
+  Created for the AgruminoFlash project.
+
+  The sensor counts the light for 2^n cycles of its internal clock: a 16 bit
+  conversion takes ~90 ms, every 4 bits less are 16 times faster (12 bit
+  5.6 ms, 8 bit 0.35 ms, 4 bit 22 us). The counts span one of four ranges
+  (1000, 4000, 16000 and 64000 lux full scale). The driver:
+    - converts once and lets the sensor power down by itself ("ALS once"
+      mode): it draws current only while integrating, not while the board
+      is on
+    - auto-ranges (setAutoRange()): a saturated conversion is done again on
+      the range up, one below a fifth of the scale on the range down
+    - given a precision (setPrecision()) picks the resolution: an 8 bit
+      probe finds the range and the light, then the fastest resolution that
+      gives the precision converts, unless the probe is enough already. In
+      the shade a 1% reading is a 12 bit conversion instead of a 16 bit one,
+      in the sun the 8 bit probe
+  A measurement doesn't block: start(), then poll() until true (nothing is
+  sent on the bus before the integration is over). read() does both.
+  Every transaction goes through I2CBus (I2CBus.h).
+
+  Example:
+    ISL29003 light;
+    light.powerUp();
+    light.setAutoRange(true);
+    light.setPrecision(1.0, 1.0);     // 1% or 1 lux
+    light.start();
+    ...other work...
+    while (!light.poll())
+      light.waitConversion();
+    Serial.println(light.getLux());
+*/
+
+#ifndef ISL29003_h
+#define ISL29003_h
+
+#include <Arduino.h>
+#include "../I2CBus/I2CBus.h"
+
+#define ISL29003_ADDRESS              0x44
+#define ISL29003_REG_COMMAND_1        0x00 // Operation mode, bits 7:5
+#define ISL29003_REG_COMMAND_2        0x01 // Resolution, bits 3:2, and range, bits 1:0
+#define ISL29003_REG_DATA             0x02 // LSB, the MSB at 0x03
+#define ISL29003_MODE_POWER_DOWN      0x00
+#define ISL29003_MODE_ALS_ONCE        0x20 // One integration, then power down
+#define ISL29003_MODE_ALS_CONTINUOUS  0xA0
+#define ISL29003_MARGIN_PERCENT         10 // Added to the typical integration time: the internal clock isn't trimmed
+#define ISL29003_MAX_CONVERSIONS         6 // Of a measurement: the probe, the range steps and the final conversion
+
+typedef enum {
+  ISL29003_RES_16 = 0,  // ~90 ms
+  ISL29003_RES_12,      // ~5.6 ms
+  ISL29003_RES_8,       // ~0.35 ms
+  ISL29003_RES_4        // ~22 us
+} isl29003_resolution_t;
+
+typedef enum {
+  ISL29003_RANGE_1000 = 0,
+  ISL29003_RANGE_4000,
+  ISL29003_RANGE_16000,
+  ISL29003_RANGE_64000
+} isl29003_range_t;
+
+class ISL29003 {
+public:
+  ISL29003(uint8_t address = ISL29003_ADDRESS);
+
+  void powerUp();
+  void invalidate();
+  uint8_t powerDown();
+
+  void setResolution(isl29003_resolution_t resolution);
+  void setRange(isl29003_range_t range);
+  void setAutoRange(bool enabled);
+  void setPrecision(float percent, float minLux = 0);
+
+  bool start();
+  bool poll();
+  float read();
+  void waitConversion();
+  bool isBusy() {return _phase != ISL29003_IDLE;}
+  uint32_t getWaitMicros();
+
+  float getLux() {return _lux;}
+  uint16_t getCounts() {return _counts;}
+  isl29003_range_t getRange() {return _range;}
+  isl29003_resolution_t getResolution() {return _converting;} // Of the last conversion
+  uint8_t getConversions() {return _conversions;}             // Of the last measurement
+  uint8_t getError() {return _error;}                         // I2C_BUS_OK if the last measurement succeeded
+
+  static uint32_t conversionMicros(isl29003_resolution_t resolution);
+
+protected:
+  enum {ISL29003_IDLE, ISL29003_PROBING, ISL29003_CONVERTING, ISL29003_DONE};
+
+  bool convert(isl29003_resolution_t resolution);
+  bool isPrecise(uint16_t probeCounts, isl29003_resolution_t resolution);
+  bool finish(uint8_t error);
+  uint8_t readCounts(uint16_t &counts);
+  static uint16_t fullScale(isl29003_resolution_t resolution) {return (1UL << (16 - 4 * resolution)) - 1;}
+
+  uint8_t _address;
+  uint8_t _command2;        // Shadow of Command-II
+  bool _command2Valid;
+  isl29003_resolution_t _resolution;
+  isl29003_range_t _range;
+  bool _autoRange;
+  uint16_t _minCounts;      // Counts that give the precision, 0 for the fixed resolution
+  float _minLux;            // A step this small is precise enough
+
+  uint8_t _phase;
+  isl29003_resolution_t _converting;
+  uint32_t _startedAt;      // micros() at the start of the conversion
+  uint32_t _duration;
+  uint8_t _conversions;
+  int8_t _step;             // Direction of the range steps of the measurement: they never turn back
+  uint16_t _counts;
+  float _lux;
+  uint8_t _error;
+};
+
+#endif
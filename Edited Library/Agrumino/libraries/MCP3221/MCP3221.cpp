@@ -56,9 +56,9 @@ MCP3221::MCP3221(
      _alpha(alpha),
      _voltageInput(voltageInput),
      _smoothing(smoothingMethod),
-     _numSamples(numSamples)
+     _numSamples(constrain(numSamples, MIN_NUM_SAMPLES, MAX_NUM_SAMPLES))
      {
-        _samples[MAX_NUM_SAMPLES] = { 0 };
+        resetFilter();
         if (((res1 != 0) && (res2 != 0)) && (_voltageInput == VOLTAGE_INPUT_12V)) {
             _res1 = res1;
             _res2 = res2;
@@ -85,8 +85,7 @@ MCP3221::~MCP3221() {}
 // See meaning of I2C Error Code values in README
 
 byte MCP3221::ping() {
-    Wire.beginTransmission(_devAddr);
-    return Wire.endTransmission();
+    return i2cBus.ping(_devAddr);
 }
 
 /*==============================================================================================================*
@@ -150,7 +149,9 @@ byte MCP3221::getSmoothing() {
  *==============================================================================================================*/
 
 unsigned int MCP3221::getData() {
-    return (_smoothing == NO_SMOOTHING) ? getRawData() : smoothData(getRawData());
+    unsigned int rawData = getRawData();
+    if ((_smoothing == NO_SMOOTHING) || (_comBuffer != COM_SUCCESS)) return rawData;  // a failed reading is not smoothed
+    return smoothData(rawData);
 }
 
 /*==============================================================================================================*
@@ -211,7 +212,7 @@ void MCP3221::setAlpha(unsigned int newAlpha) {
 void MCP3221::setNumSamples(byte newNumSamples) {                                    // PARAM RANGE: 1-20
     newNumSamples = constrain(newNumSamples, MIN_NUM_SAMPLES, MAX_NUM_SAMPLES);
     _numSamples = newNumSamples;
-    for (byte i=0; i<MAX_NUM_SAMPLES; i++) _samples[i] = 0;
+    setFilterState(getFilterState());
 }
 
 /*==============================================================================================================*
@@ -232,10 +233,40 @@ void MCP3221::setVinput(voltage_input_t newVoltageInput) {     // PARAMS: VOLTAG
 
 void MCP3221::setSmoothing(smoothing_t newSmoothing) {           // PARAMS: NO_SMOOTHING / ROLLING / EMAVG
     _smoothing = newSmoothing;
+    setFilterState(getFilterState());
 }
 
 /*==============================================================================================================*
-    RESET
+    GET FILTER STATE (LAST SMOOTHED VALUE, FILTER_EMPTY = EMPTY FILTER)
+ *==============================================================================================================*/
+
+unsigned int MCP3221::getFilterState() {
+    return _filterValid ? _smoothed : FILTER_EMPTY;
+}
+
+/*==============================================================================================================*
+    SET FILTER STATE (RESTORES A STATE SAVED WITH getFilterState(), FILTER_EMPTY = EMPTY FILTER)
+ *==============================================================================================================*/
+
+void MCP3221::setFilterState(unsigned int newState) {
+    _filterValid = newState != FILTER_EMPTY;
+    if (!_filterValid) newState = 0;
+    _smoothed = newState;
+    for (byte i=0; i<MAX_NUM_SAMPLES; i++) _samples[i] = newState;
+    _sampleSum = (unsigned long)newState * _numSamples;
+    _sampleHead = 0;
+}
+
+/*==============================================================================================================*
+    RESET FILTER (THE NEXT READING STARTS THE SMOOTHING AGAIN)
+ *==============================================================================================================*/
+
+void MCP3221::resetFilter() {
+    setFilterState(FILTER_EMPTY);
+}
+
+/*==============================================================================================================*
+    RESET (SETTINGS ONLY, THE FILTER STATE IS KEPT)
  *==============================================================================================================*/
 
 void MCP3221::reset() {
@@ -254,8 +285,9 @@ void MCP3221::reset() {
 
 unsigned int MCP3221::getRawData() {
     unsigned int rawData = 0;
-    Wire.requestFrom(_devAddr, DATA_BYTES);
-    if (Wire.available() == DATA_BYTES) rawData = (Wire.read() << 8) | (Wire.read());
+    byte data[DATA_BYTES];
+    _comBuffer = i2cBus.receive(_devAddr, data, DATA_BYTES);
+    if (_comBuffer == I2C_BUS_OK) rawData = (data[0] << 8) | data[1];
     return rawData;
 }
 
@@ -264,23 +296,16 @@ unsigned int MCP3221::getRawData() {
  *==============================================================================================================*/
 
 unsigned int MCP3221::smoothData(unsigned int rawData) {
-    unsigned int smoothedData;
+    if (!_filterValid) setFilterState(rawData);                                 // empty filter: start from this reading
     if (_smoothing == EMAVG) {                                                  // Exmponential Moving Average
-        static unsigned int emAvg = rawData;
-        emAvg = (_alpha * (unsigned long)rawData + (MAX_ALPHA - _alpha) * (unsigned long)emAvg) / MAX_ALPHA;
-        smoothedData = emAvg;
-    } else {                                                                    // Rolling-Average
-        unsigned long sum = 0;
-        if (_samples[_numSamples - 1] != 0) {
-            for (byte i = 1; i<_numSamples; i++) _samples[i - 1] = _samples[i]; // drop last reading & rearrange array
-            _samples[_numSamples - 1] = rawData;                                // add a new sample at the end of array
-            for (byte j=0; j<_numSamples; j++) sum += _samples[j];              // aggregate all samples
-            smoothedData = sum / _numSamples;                                   // calculate average
-        } else {
-            for (byte i = 0; i<_numSamples; i++) _samples[i] = rawData;
-            smoothedData = rawData;
-        }
+        _smoothed = (_alpha * (unsigned long)rawData + (MAX_ALPHA - _alpha) * (unsigned long)_smoothed) / MAX_ALPHA;
+    } else {                                                                    // Rolling-Average (ring buffer)
+        _sampleSum -= _samples[_sampleHead];                                    // drop the oldest sample
+        _sampleSum += rawData;
+        _samples[_sampleHead] = rawData;                                        // the new sample takes its place
+        if (++_sampleHead >= _numSamples) _sampleHead = 0;
+        _smoothed = _sampleSum / _numSamples;
     }
-    return smoothedData;
+    return _smoothed;
 }
 
@@ -91,6 +91,16 @@
     NUMBER OF SAMPLES:              10   // used by Rolling-Average smoothing method (range: 1-20 Samples)
     ALPHA                          178   // factor used by EMAVG smoothing method (range: 1-256)
 
+ *===============================================================================================================*
+    SMOOTHING STATE
+ *===============================================================================================================*
+
+    Each instance keeps its own filter. The filter starts from the first reading, and its state can be saved
+    with getFilterState() and restored with setFilterState() (e.g. in the ESP8266 RTC memory, across a deep
+    sleep), so the smoothing spans more than one power cycle. The saved state is the last smoothed value: it
+    restores the EMAVG filter exactly, the Rolling-Average filter as a buffer full of that value. An empty
+    filter is saved as FILTER_EMPTY (0xFFFF, never a 12-bit reading), so a reading of 0 is a valid state.
+
  *===============================================================================================================*
     BUG REPORTS
  *===============================================================================================================*
@@ -130,11 +140,12 @@ __asm volatile ("nop");
 #define MCP3221_h
 
 #if !defined(ARDUINO_ARCH_AVR)
-#warning “The MCP3221 library only supports AVR processors.”
+#warning "The MCP3221 library only supports AVR processors."
 #endif
 
 #include <Arduino.h>
 #include <Wire.h>
+#include "../I2CBus/I2CBus.h"
 #include "utility/MCP3221_PString.h"
 
 namespace Mcp3221 {
@@ -153,6 +164,7 @@ namespace Mcp3221 {
     const byte         MIN_NUM_SAMPLES     =     1;     // minimum number of samples (for Rolling-Average smoothing)
     const byte         MAX_NUM_SAMPLES     =    20;     // maximum number of samples (for Rolling-Average smoothing)
     const byte         DEFAULT_NUM_SAMPLES =    10;     // default number of samples (for Rolling-Average smoothing)
+    const unsigned int FILTER_EMPTY        = 0xFFFF;    // filter state of an empty filter (not a 12-bit reading)
 
     typedef enum:byte {
         VOLTAGE_INPUT_5V  = 0,  // default
@@ -196,11 +208,18 @@ namespace Mcp3221 {
             void         setNumSamples(byte newNumSamples);
             void         setVinput(voltage_input_t newVinput);
             void         setSmoothing(smoothing_t newSmoothing);
+            unsigned int getFilterState();
+            void         setFilterState(unsigned int newState);
+            void         resetFilter();
             void         reset();
         private:
             byte         _devAddr, _voltageInput, _smoothing, _numSamples, _comBuffer;
             unsigned int _vRef, _res1, _res2, _alpha;
-            unsigned int _samples[MAX_NUM_SAMPLES];
+            unsigned int _samples[MAX_NUM_SAMPLES];                  // Rolling-Average ring buffer
+            byte         _sampleHead;                                // oldest sample (next to be replaced)
+            unsigned long _sampleSum;                                // sum of the samples in the ring buffer
+            unsigned int _smoothed;                                  // last smoothed value (valid if _filterValid)
+            bool         _filterValid;                               // false until the first reading (empty filter)
             unsigned int getRawData();
             unsigned int smoothData(unsigned int rawData);
             friend       MCP3221_PString MCP3221ComStr(const MCP3221&);
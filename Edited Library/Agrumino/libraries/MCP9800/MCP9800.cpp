@@ -1,5 +1,14 @@
 #include "MCP9800.h"
 
+MCP9800::MCP9800()
+: adc(MCP_ADC_RES_9)
+, config(0)
+, configValid(false)
+, converting(false)
+, conversionStart(0)
+{
+}
+
 bool MCP9800::init(bool initWire)
 {
 #ifdef ARDUINO
@@ -11,24 +20,26 @@ bool MCP9800::init(bool initWire)
 		i2c_init();
 	}
 #endif
-	uint8_t config;
-	read(REG_CONFIG, &config, 1);
-	bool ok = (config == 0); // all values are 0 on power up
+	configValid = read(REG_CONFIG, &config, 1);
+	bool ok = configValid && config == 0; // all values are 0 on power up
+	config &= ~(1 << CONFIG_ONE_SHOT);
+	adc = (config >> CONFIG_ADC_RES) & 3;
+	converting = false;
 	return ok;
 }
 
-void MCP9800::write(uint8_t reg, uint8_t *data, int8_t len)
+void MCP9800::powerUp()
 {
-#ifdef ARDUINO
-	Wire.beginTransmission(MCP9800_ADDRESS);
-	Wire.write(reg);
-
-	while (len--)
-	{
-		Wire.write(*data++);
-	}
+	config = 0;
+	configValid = true;
+	adc = MCP_ADC_RES_9;
+	converting = false;
+}
 
-	Wire.endTransmission();
+bool MCP9800::write(uint8_t reg, uint8_t *data, int8_t len)
+{
+#ifdef ARDUINO
+	return i2cBus.write(MCP9800_ADDRESS, reg, data, len) == I2C_BUS_OK;
 #else
 	i2c_start_wait((MCP9800_ADDRESS << 1));
 	i2c_write(reg);
@@ -37,21 +48,23 @@ void MCP9800::write(uint8_t reg, uint8_t *data, int8_t len)
 		i2c_write(*data++);
 	}
 	i2c_stop();
+	return true;
 #endif
 }
 
-void MCP9800::read(uint8_t reg, uint8_t *buffer, int8_t numBytes)
+bool MCP9800::read(uint8_t reg, uint8_t *buffer, int8_t numBytes)
 {
 #ifdef ARDUINO
-	Wire.beginTransmission(MCP9800_ADDRESS);
-	Wire.write(reg);
-	Wire.endTransmission();
-	Wire.requestFrom((uint8_t)MCP9800_ADDRESS, (uint8_t)numBytes);
-	while (Wire.available() < numBytes) {}; // wait for data to come back
-	while (numBytes--)
+	// bounded: a missing or stuck chip reads as 0 instead of hanging here
+	if (i2cBus.read(MCP9800_ADDRESS, reg, buffer, numBytes) != I2C_BUS_OK)
 	{
-		*buffer++ = Wire.read();
+		if (buffer)
+		{
+			memset(buffer, 0, numBytes);
+		}
+		return false;
 	}
+	return true;
 #else
 	i2c_start_wait(MCP9800_ADDRESS << 1);
 	i2c_write(reg);
@@ -63,57 +76,99 @@ void MCP9800::read(uint8_t reg, uint8_t *buffer, int8_t numBytes)
 	}
 	*buffer++ = i2c_readNak();
 	i2c_stop();
+	return true;
 #endif
 }
 
+// Read-modify-write of the config register on its shadow: read only if the
+// shadow isn't known, written only if it changes
+void MCP9800::writeConfig(uint8_t mask, uint8_t value)
+{
+	if (!configValid)
+	{
+		read(REG_CONFIG, &config, 1);
+		config &= ~(1 << CONFIG_ONE_SHOT);
+		configValid = true;
+	}
+	uint8_t updated = (config & ~mask) | (value & mask);
+	if (updated != config)
+	{
+		config = updated;
+		write(REG_CONFIG, &config, 1);
+	}
+}
+
 void MCP9800::setOneShot(bool enabled)
 {
-	// device needs to be in shutdown mode first
+	// one shot conversions are started in shutdown mode, see startConversion()
 	setShutdown(enabled);
-
-	uint8_t config = 0;
-	read(REG_CONFIG, &config, 1);
-	config &= ~(1 << CONFIG_ONE_SHOT);
-	config |= (enabled << CONFIG_ONE_SHOT);
-	write(REG_CONFIG, &config, 1);
 }
 
 void MCP9800::setResolution(mcp9800_adc_resolution_t resolution)
 {
-	uint8_t config = 0;
-	read(REG_CONFIG, &config, 1);
-	config &= ~(3 << CONFIG_ADC_RES);
-	config |= (resolution << CONFIG_ADC_RES);
-	write(REG_CONFIG, &config, 1);
+	writeConfig(3 << CONFIG_ADC_RES, resolution << CONFIG_ADC_RES);
 	adc = resolution;
 }
 
 void MCP9800::setFaultQueue(mcp9800_fault_queue_t numFaults)
 {
-	uint8_t config = 0;
-	read(REG_CONFIG, &config, 1);
-	config &= ~(3 << CONFIG_FAULT_QUEUE);
-	config |= (numFaults << CONFIG_FAULT_QUEUE);
-	write(REG_CONFIG, &config, 1);
+	writeConfig(3 << CONFIG_FAULT_QUEUE, numFaults << CONFIG_FAULT_QUEUE);
 }
 
 void MCP9800::setShutdown(bool shutdown)
 {
-	uint8_t config = 0;
-	read(REG_CONFIG, &config, 1);
-	config &= ~(1 << CONFIG_SHUTDOWN);
-	config |= (shutdown << CONFIG_SHUTDOWN);
-	write(REG_CONFIG, &config, 1);
+	writeConfig(1 << CONFIG_SHUTDOWN, shutdown << CONFIG_SHUTDOWN);
+	converting = false;
 }
 
 void MCP9800::setAlertMode(mcp9800_alert_mode_t alertMode, bool polarity)
 {
-	uint8_t config = 0;
-	read(REG_CONFIG, &config, 1);
-	config &= ~(1 << CONFIG_COMP_INT);
-	config &= ~(1 << CONFIG_ALERT_POL);
-	config |= (alertMode << CONFIG_COMP_INT) | (polarity << CONFIG_ALERT_POL);
-	write(REG_CONFIG, &config, 1);
+	writeConfig((1 << CONFIG_COMP_INT) | (1 << CONFIG_ALERT_POL), (alertMode << CONFIG_COMP_INT) | (polarity << CONFIG_ALERT_POL));
+}
+
+void MCP9800::startConversion()
+{
+	writeConfig(0, 0); // the shadow is needed
+	if (!(config & (1 << CONFIG_SHUTDOWN)))
+	{
+		return;
+	}
+	uint8_t start = config | (1 << CONFIG_ONE_SHOT);
+	converting = write(REG_CONFIG, &start, 1); // nothing to wait for from a missing chip
+	conversionStart = millis();
+}
+
+bool MCP9800::isConversionReady()
+{
+	if (!converting)
+	{
+		return true;
+	}
+	unsigned long elapsed = millis() - conversionStart;
+	if (elapsed < getConversionMillis())
+	{
+		return false;
+	}
+	if (elapsed >= ((unsigned long) MCP9800_CONVERSION_MAX_MS << adc))
+	{
+		return true;
+	}
+	uint8_t current = 0;
+	read(REG_CONFIG, &current, 1);
+	return !(current & (1 << CONFIG_ONE_SHOT));
+}
+
+void MCP9800::waitConversion()
+{
+	while (!isConversionReady())
+	{
+		delay(1);
+	}
+}
+
+uint16_t MCP9800::getConversionMillis()
+{
+	return MCP9800_CONVERSION_MS << adc;
 }
 
 void MCP9800::setAlertLimits(int8_t lower, int8_t upper)
@@ -138,6 +193,15 @@ void MCP9800::resetAlert()
 
 int16_t MCP9800::readRawData()
 {
+	if (configValid && (config & (1 << CONFIG_SHUTDOWN)))
+	{
+		if (!converting)
+		{
+			startConversion();
+		}
+		waitConversion();
+		converting = false;
+	}
 	uint8_t temp[2] = {0,0};
 	read(REG_TEMP, temp, 2);
 	return (temp[0] << 8) | temp[1];
@@ -4,6 +4,7 @@
 #if (ARDUINO >= 100)
 #include <Arduino.h>
 #include <Wire.h>
+#include "../I2CBus/I2CBus.h"
 #else
 #include <stdlib.h>
 #include <avr/io.h>
@@ -38,6 +39,8 @@ class MCP9800
 {
 
 	public:
+		MCP9800();
+
 		/**
 		 * @brief   Initializes the chip
 		 * 
@@ -45,10 +48,17 @@ class MCP9800
 		 */
 		bool init(bool initWire);
 
+		/**
+		 * @brief   The chip has just been powered: its registers hold the power-up defaults
+		 * @details Sets the shadow of the config register without any I2C traffic, instead of init()
+		 */
+		void powerUp();
+
 		/**
 		 * @brief   Toggles one shot mode on/off
 		 * @details One shot keeps the chip powered down and only wakes up when temperature is requested. 
-		 *          Consumes 0.1uA between reads and wakes up for 200uA for 30ms when reading temp
+		 *          Consumes 0.1uA between reads and wakes up for 200uA for 30ms when reading temp.
+		 *          The chip is shut down, every reading starts a conversion (see startConversion())
 		 * 
 		 * @param   enabled true to enable one shot mode
 		 */
@@ -79,6 +89,30 @@ class MCP9800
 		 */
 		void setShutdown(bool shutdown);
 
+		/**
+		 * @brief   Starts a one shot conversion
+		 * @details The conversion takes getConversionMillis(): the caller can do other work meanwhile
+		 *          and read when isConversionReady(). Nothing to do out of one shot mode
+		 */
+		void startConversion();
+
+		/**
+		 * @brief   True if the temperature register holds the conversion started by startConversion()
+		 * @details No I2C traffic before the typical conversion time, then the ONE_SHOT bit
+		 *          is polled until the chip clears it (at most the maximum conversion time)
+		 */
+		bool isConversionReady();
+
+		/**
+		 * @brief   Waits for the conversion started by startConversion()
+		 */
+		void waitConversion();
+
+		/**
+		 * @brief   Typical conversion time at the current resolution: 30ms at 9bit, up to 240ms at 12bit
+		 */
+		uint16_t getConversionMillis();
+
 		/**
 		 * @brief   Sets alert pin behavior
 		 * @details Sets the pin to either continuously keep the alert pin active or only assert it until an MCU has reacted to it and cleared it using resetAlert()
@@ -114,6 +148,8 @@ class MCP9800
 
 		/**
 		 * @brief   Reads temperature in celcius * 16
+		 * @details In one shot mode the temperature of the conversion started by startConversion(),
+		 *          waiting for it, or of a new conversion
 		 * @return  Current temperature in celsius. Divide by 16 to get actual reading
 		 */
 		int16_t readCelsius();
@@ -137,9 +173,14 @@ class MCP9800
 		float readFahrenheitf();
 
 	private:
-		void write(uint8_t reg, uint8_t *data, int8_t len);
-		void read(uint8_t reg, uint8_t *buffer, int8_t numBytes);
+		bool write(uint8_t reg, uint8_t *data, int8_t len);
+		bool read(uint8_t reg, uint8_t *buffer, int8_t numBytes);
+		void writeConfig(uint8_t mask, uint8_t value);
 		uint8_t adc;
+		uint8_t config;				// Shadow of REG_CONFIG (without the self-clearing ONE_SHOT bit)
+		bool configValid;
+		bool converting;			// A one shot conversion started and not read yet
+		unsigned long conversionStart;
 };
 
 
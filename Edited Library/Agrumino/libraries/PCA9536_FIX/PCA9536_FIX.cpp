@@ -44,6 +44,8 @@ __asm volatile ("nop");
 
 PCA9536::PCA9536() {
 //    _comBuffer = ping();
+    _comBuffer = COM_SUCCESS;
+    invalidate();
 }
 
 /*==============================================================================================================*
@@ -59,8 +61,7 @@ PCA9536::~PCA9536() {}
 // For meaning of I2C Error Codes see README
 
 byte PCA9536::ping() {
-    Wire.beginTransmission(DEV_ADDR);
-    return Wire.endTransmission();
+    return i2cBus.ping(DEV_ADDR);
 }
 
 /*==============================================================================================================*
@@ -160,28 +161,50 @@ void PCA9536::setPolarity(polarity_t newPolarity) {                     // PARAM
  *==============================================================================================================*/
 
 void PCA9536::reset() {
+    invalidate();
     setMode(IO_INPUT);
     setState(IO_HIGH);
     setPolarity(IO_NON_INVERTED);
-    initCall(REG_INPUT);
-    endCall();
+    _comBuffer = i2cBus.write(DEV_ADDR, REG_INPUT, NULL, 0);                 // pointer back to the input register
+}
+
+/*==============================================================================================================*
+    POWER UP (THE CHIP HAS JUST BEEN POWERED: ITS REGISTERS HOLD THE POWER-UP DEFAULTS, NO I2C TRAFFIC)
+ *==============================================================================================================*/
+
+void PCA9536::powerUp() {
+    _shadow[REG_OUTPUT]     = ALL_HIGH;
+    _shadow[REG_POLARITY]   = ALL_NON_INVERTED;
+    _shadow[REG_CONFIG_PCA] = ALL_INPUT;
+    _shadowValid = bit(REG_OUTPUT) | bit(REG_POLARITY) | bit(REG_CONFIG_PCA);
+}
+
+/*==============================================================================================================*
+    INVALIDATE (FORGET THE REGISTER SHADOWS: THE NEXT ACCESS READS THE CHIP AGAIN)
+ *==============================================================================================================*/
+
+// Call it when the chip may have changed behind the driver's back (power loss, another master on the bus)
+
+void PCA9536::invalidate() {
+    _shadowValid = 0;
 }
 
 /*==============================================================================================================*
     GET REGISTER DATA
  *==============================================================================================================*/
 
+// The output, polarity and config registers only change when written, so after the first read (or write)
+// they are served from the shadows. The input register is always read from the chip.
+
 byte PCA9536::getReg(reg_ptr_t regPtr) {
+    if (bitRead(_shadowValid, regPtr)) {
+        return _shadow[regPtr];
+    }
     byte regData = 0;
-    initCall(regPtr);
-    endCall();
-    if (_comBuffer == COM_SUCCESS) {
-        Wire.requestFrom(DEV_ADDR, NUM_BYTES);
-        if (Wire.available() == NUM_BYTES) regData = Wire.read();
-        else {
-            while (Wire.available()) Wire.read();
-            _comBuffer = ping();
-        }
+    _comBuffer = i2cBus.read(DEV_ADDR, regPtr, &regData, NUM_BYTES);         // timeouts and retries: see I2CBus.h
+    if (_comBuffer == COM_SUCCESS && regPtr > 0) {
+        _shadow[regPtr] = regData;
+        bitSet(_shadowValid, regPtr);
     }
     return regData;
 }
@@ -200,9 +223,9 @@ byte PCA9536::getPin(pin_t pin, reg_ptr_t regPtr) {
 
 void PCA9536::setReg(reg_ptr_t regPtr, byte newSetting) {
     if (regPtr > 0) {
-        initCall(regPtr);
-        Wire.write(newSetting);
-        endCall();
+        _comBuffer = i2cBus.write(DEV_ADDR, regPtr, &newSetting, NUM_BYTES);
+        _shadow[regPtr] = newSetting;
+        bitWrite(_shadowValid, regPtr, _comBuffer == COM_SUCCESS);           // failed write: the chip value is unknown
     }
 }
 
@@ -216,23 +239,6 @@ void PCA9536::setPin(pin_t pin, reg_ptr_t regPtr, byte newSetting) {
     setReg(regPtr, newReg);
 }
 
-/*==============================================================================================================*
-    INITIATE I2C COMMUNICATION
- *==============================================================================================================*/
-
-void PCA9536::initCall(reg_ptr_t regPtr) {
-    Wire.beginTransmission(DEV_ADDR);
-    Wire.write(regPtr);
-}
-
-/*==============================================================================================================*
-    END I2C COMMUNICATION
- *==============================================================================================================*/
-
-void PCA9536::endCall() {
-    _comBuffer = Wire.endTransmission();
-}
-
 /*==============================================================================================================*
     GET COMMUNICATION RESULT
  *==============================================================================================================*/
@@ -123,11 +123,12 @@ __asm volatile ("nop");
 #define PCA9536_h
 
 #if !defined(ARDUINO_ARCH_AVR)
-#warning “The PCA9536 library only supports AVR processors.”
+#warning "The PCA9536 library only supports AVR processors."
 #endif
 
 #include <Arduino.h>
 #include "Wire.h"
+#include "../I2CBus/I2CBus.h"
 
 namespace Pca9536 {
 
@@ -140,6 +141,7 @@ namespace Pca9536 {
     const byte ALL_NON_INVERTED = 0x00;
     const byte ALL_INVERTED     = 0xFF;
     const byte COM_SUCCESS      = 0x00;
+    const byte NUM_REGS         = 0x04;
 
     typedef enum:byte {
         REG_INPUT    = 0,      // default
@@ -187,15 +189,17 @@ namespace Pca9536 {
             void setPolarity(pin_t pin, polarity_t newPolarity);
             void setPolarity(polarity_t newPolarity);
             void reset();
+            void powerUp();
+            void invalidate();
             byte getComResult();
          private:
             byte _comBuffer;
+            byte _shadow[NUM_REGS];                                     // write-through copies of registers 1-3
+            byte _shadowValid;                                          // bit n set = _shadow[n] matches the chip
             byte getReg(reg_ptr_t regPtr);
             byte getPin(pin_t pin, reg_ptr_t regPtr);
             void setReg(reg_ptr_t ptr, byte newSetting);
             void setPin(pin_t pin, reg_ptr_t regPtr, byte newSetting);
-            void initCall(reg_ptr_t regPtr);
-            void endCall();
     };
 }
 
@@ -1,5 +1,9 @@
 #include <Agrumino.h>
 #include <ESP8266WiFi.h>
+#include <AgruminoThingSpeak.h>
+#include <AgruminoFrames.h>
+#include <AgruminoFlushPolicy.h>
+#include <AgruminoWiFi.h>
 
 //////////////////////////
 ///     WIFI SETUP    ///
@@ -14,26 +18,22 @@
 
 Agrumino agrumino;
 
-int hours = 4; //change this to change the frequency of the data pushing
+//decides when to push the data (see AgruminoFlushPolicy.h)
+AgruminoFlushPolicy flushPolicy;
 
-//temp variable to store the addresses
-int attUSBADD;
-int chargADD;
-int buttonADD;
-int tempADD;
-int soilADD;
-int illADD;
-int voltADD;
-int battLVLADD;
-
-//tells us if the memory is dirty
-boolean wrote=false;
+//reconnects to the last access point with the last address, without scan and DHCP (see AgruminoWiFi.h)
+AgruminoWiFi wifi(SSID, PASSWORD);
 
 ///////////////////////////////////
 ///        THING SPEAK         ///
 /////////////////////////////////
 const char* host = "api.thingspeak.com";
 const char* writeAPIKey = "Use the Key that Thingspeak indicates for writing data";
+unsigned long channelID = 0; //the ID of the Thingspeak channel
+
+//uncomment to push the data to your own receiver (extras/receiver in the library) in binary frames, instead of Thingspeak
+//#define BINARY_UPLOAD_HOST "192.168.1.10"
+//#define BINARY_UPLOAD_PORT 8080
 
 
 void setup() {
@@ -43,33 +43,24 @@ void setup() {
   agrumino.setup();
   agrumino.turnBoardOn();
   agrumino.enableMemory();
-  
-  //checking if the memory is "dirty" (A.K.A if there's some data to push)
-  if(agrumino.getDirty()==0)
-    wrote=false; //not dirty
-  else
-     wrote=true; //dirty
+
+  //pushing the data at least every 4 hours (24 with low battery), after 1 hour if the readings changed
+  flushPolicy.setHours(1, 4);
+  //uncomment to keep the WiFi cache in the flash too, for the reconnects after a power loss (takes a SPIFFS sector, see AgruminoWiFi.h)
+  //wifi.setFlashFallback(true);
   blinkLed(500,2);
 }
 
 void setup_wifi() {
 
-  int tryWiFi = WIFITIMEOUT * 2;
-  delay(100);
-
   Serial.print("Connecting to ");
   Serial.println(SSID);
-  WiFi.mode(WIFI_STA);
-  WiFi.begin(SSID, PASSWORD);
 
-  while ((WiFi.status() != WL_CONNECTED) && (tryWiFi > 0))
+  if (wifi.connect(WIFITIMEOUT * 1000))
   {
-    delay(500);
-    tryWiFi --;
-    Serial.print(".");
+    Serial.println(String(wifi.isFastConnect() ? "Reconnected" : "Connected") + " in " + String(wifi.getConnectMillis()) + " ms");
   }
-
-  if (tryWiFi == 0)
+  else
   {
     blinkLed(300,3);
     agrumino.turnBoardOff(); // Board off before delay/sleep to save battery :)
@@ -81,158 +72,95 @@ void loop() {
 
   Serial.println("#########################\n");
 
-    if(wrote && agrumino.getHours()>=hours) //checking if enough time has been passed since the last upload
-    {
-      setup_wifi(); //setting up wifi only when pushing data
-      int h = 0; //used to iterate
-      while(h<agrumino.getHours())
-      {
-          //Reading all the datas from the flash
-          Serial.println("("+String(h)+")");
-          //getting the address of every sensor data, based on the offset of its data type
-          attUSBADD = agrumino.getStartAddress();
-          chargADD = attUSBADD+1 ;
-          buttonADD = chargADD+1;
-          tempADD = buttonADD+1;
-          soilADD = tempADD+4;
-          illADD = soilADD+4;
-          voltADD = illADD+4;
-          battLVLADD = voltADD+4;
+  //collecting sensors data
+  Serial.println("\nREADING DATA...");
+  //all the sensors are read together: the wait is the one of the slowest sensor
+  AgruminoSample sample;
+  agrumino.sampleAll(sample);
+
+  Serial.println("\nSTORING DATA IN FLASH...");
+
+  //storing the whole sample and increasing the hours counter in a batch,
+  //so the flash is erased and written only once
+  int index = agrumino.getRecordCount<AgruminoSample>();
+  agrumino.beginBatch();
+  boolean stored = agrumino.appendRecord(sample);
+  agrumino.incrHours();
+  agrumino.commitBatch();
+
+  //printing the values stored in memory, to check its legality
+  AgruminoSample check;
+  if(stored && agrumino.readRecord(index, check))
+  {
+      Serial.println("\nJUST STORED IN MEMORY: ");
+      printSample(check);
+  }
 
+  //asking the flush policy (see AgruminoFlushPolicy.h) if it's time to push the buffered data:
+  //the radio is turned on only when the memory is almost full, on USB power, after too many
+  //hours or when the readings changed enough
+  uint8_t reasons = flushPolicy.decide(agrumino, sample);
+  if(!stored)
+      reasons |= AGRUMINO_FLUSH_FULL; //never reached with a sensible reserve, but the sample mustn't be lost
+  if(reasons)
+  {
+      Serial.println("\nPUSHING DATA: " + String(AgruminoFlushPolicy::reasonName(reasons)));
+      setup_wifi(); //setting up wifi only when pushing data
 
+      //every sample is a record (see AgruminoRecord.h), read in place from the flash copy in RAM
+      AgruminoRecordSpan<AgruminoSample> samples = agrumino.getRecords<AgruminoSample>();
+      for(size_t h=0; h<samples.size(); h++)
+      {
           //printing the values obtained from the memory
+          Serial.println("("+String(h)+")");
           Serial.println("\nREAD FROM FLASH: ");
-          Serial.println("isAttachedToUSB:   " + String(agrumino.boolRead(attUSBADD)));
-          Serial.println("isBatteryCharging: " + String(agrumino.boolRead(chargADD)));
-          Serial.println("isButtonPressed: "+String(agrumino.boolRead(buttonADD)));
-          Serial.println("temperature:       " + String(agrumino.floatRead(tempADD)));
-          Serial.println("soilMoisture:      " + String(agrumino.floatRead(soilADD)));
-          Serial.println("illuminance :      " + String(agrumino.floatRead(illADD)));
-          Serial.println("batteryVoltage :   " + String(agrumino.floatRead(voltADD)));
-          Serial.println("batteryLVL: "+String(agrumino.intRead(battLVLADD)));
-          Serial.println("");
-
-          //putting the data into variables
-          boolean isAttachedToUSB =   agrumino.boolRead(attUSBADD);
-          boolean isBatteryCharging = agrumino.boolRead(chargADD);
-          boolean isButtonPressed =   agrumino.boolRead(buttonADD);
-          float temperature =         agrumino.floatRead(tempADD);
-          float soilMoisture = agrumino.floatRead(soilADD);
-          float illuminance =         agrumino.floatRead(illADD);
-          float batteryVoltage =      agrumino.floatRead(voltADD);
-          unsigned int batteryLevel = agrumino.intRead(battLVLADD);
-
-          //soil moist. % calculus
-          float soilMoisturePerc = (2860-soilMoisture)/14;
-
-          /////thingspeak
-          Serial.println("connecting to Thingspeak :");
-          
-          int tryWiFi = WIFITIMEOUT * 2;
-          WiFiClient client;
-          const int httpPort = 80;
-          while ((!client.connect(host, httpPort)) && (tryWiFi > 0))
-          {
-            delay(500);
-            tryWiFi --;
-            Serial.print(".");
-          }
-          if (tryWiFi > 0) {
-          String url = "/update?key=";
-          url += writeAPIKey;
-          url += "&field1=";
-          url += String(temperature*1000);
-          url += "&field2=";
-          url += String((int)soilMoisturePerc);
-          url += "&field3=";
-          url += String(illuminance);
-          url += "&field4=";
-          url += String(batteryVoltage*1000);
-          url += "\r\n";
-        
-          // Request to the server
-          client.print(String("GET ") + url + " HTTP/1.1\r\n" +
-                       "Host: " + host + "\r\n" +
-                       "Connection: close\r\n\r\n");
-          Serial.println("Sent to Thingspeak :" + url);
-          blinkLed(500,2);
-          } else blinkLed ( 300,4);
-
-          agrumino.setStartAddress(battLVLADD+1); //updating the starting point for the next read
-          h++;
+          printSample(samples[h]);
       }
 
-      //cleaning the memory at the end
-      boolean init = agrumino.initializeMemory();
+      WiFiClient client;
+#ifdef BINARY_UPLOAD_HOST
+      /////own receiver: the samples as they are in flash, in CRC'd binary frames
+      Serial.println("connecting to " BINARY_UPLOAD_HOST " :");
+      AgruminoFrames frames(BINARY_UPLOAD_HOST, BINARY_UPLOAD_PORT);
+      frames.setGeneration(agrumino.getGeneration());
+      frames.setClock(agrumino.getTime()); //the receiver dates the samples from it
+      bool sent = frames.upload(client, samples);
+      client.stop();
+      Serial.println("Sent to the receiver: HTTP " + String(frames.getStatus()));
+      uint32_t serverTime = frames.getServerTime();
+#else
+      /////thingspeak: all the buffered hours in a single bulk update
+      Serial.println("connecting to Thingspeak :");
+      AgruminoThingSpeak thingSpeak(channelID, writeAPIKey, host);
+      thingSpeak.setInterval(SLEEP_TIME_SEC);
+      thingSpeak.setFields(thingSpeakFields);
+      thingSpeak.setEpoch(agrumino.getEpoch()); //every sample with its own time, once the clock is anchored
+      bool sent = thingSpeak.upload(client, samples);
+      client.stop();
+      Serial.println("Sent to Thingspeak: " + String((int)thingSpeak.getUploaded()) + " samples, HTTP " + String(thingSpeak.getStatus()));
+      uint32_t serverTime = thingSpeak.getServerTime();
+#endif
+      //anchoring the clock of the samples to the time of the server (see AgruminoClock.h)
+      if(serverTime)
+          agrumino.setTime(serverTime);
+      if(!sent)
+      {
+          //the data stays in memory and is pushed again at the next wake up
+          blinkLed(300,4);
+          agrumino.turnBoardOff();
+          deepSleepSec(SLEEP_TIME_SEC);
+      }
+      blinkLed(500,2);
+
+      //dropping the pushed data: the memory is not rewritten, its space is reclaimed when needed
+      boolean init = agrumino.discardMemory();
       if(!init)
       {
         Serial.println("Final memory clean failed: aborting");
         return;
-      }      
-  }
-  else
-  {
-      //collecting sensors data
-      Serial.println("\nREADING DATA...");
-      boolean isAttachedToUSB =   agrumino.isAttachedToUSB();
-      boolean isBatteryCharging = agrumino.isBatteryCharging();
-      boolean isButtonPressed =   agrumino.isButtonPressed();
-      float temperature =         agrumino.readTempC();
-      float soilMoisture = agrumino.readSoilRaw();
-      float illuminance =         agrumino.readLux();
-      float batteryVoltage =      agrumino.readBatteryVoltage();
-      unsigned int batteryLevel = agrumino.readBatteryLevel();
-    
-      
-      Serial.println("\nSTORING DATA IN FLASH...");
-
-      //reading the different data, and storing them into the flash memory. Also backupping the registers of every data
-      attUSBADD = agrumino.getLastAvaiableAddress();
-      agrumino.boolWrite(isAttachedToUSB);
-      Serial.println("wrote attacchedUSB (bool) in REG_"+String(attUSBADD));
-
-      chargADD = agrumino.getLastAvaiableAddress();
-      agrumino.boolWrite(isBatteryCharging);
-      Serial.println("wrote chargBatt (bool) in REG_"+String(chargADD));
-
-      buttonADD = agrumino.getLastAvaiableAddress();
-      agrumino.boolWrite(isButtonPressed);
-      Serial.println("wrote button status (bool) in REG_"+String(buttonADD));
-      
-      tempADD = agrumino.getLastAvaiableAddress();
-      agrumino.floatWrite(temperature);
-      Serial.println("wrote the temperature (float) in REG_"+String(tempADD));
-      
-      soilADD = agrumino.getLastAvaiableAddress();
-      agrumino.floatWrite(soilMoisture);
-      Serial.println("wrote the soil (int) in REG_"+String(soilADD));
-
-      illADD = agrumino.getLastAvaiableAddress();
-      agrumino.floatWrite(illuminance);
-      Serial.println("wrote the ill. (float) in REG_"+String(illADD));
-
-      voltADD = agrumino.getLastAvaiableAddress();
-      agrumino.floatWrite(batteryVoltage);
-      Serial.println("wrote the battery Voltage (float) in REG_"+String(voltADD));
-            
-      battLVLADD = agrumino.getLastAvaiableAddress();
-      agrumino.intWrite(batteryLevel);
-      Serial.println("wrote the battery level (int) in REG_"+String(battLVLADD));
-
-      //increasing the hours counter
-      agrumino.incrHours();
-            
-      //printing the values obtained from the sensors, and confronting them with the value stored in memory, to check its legality
-      Serial.println("\nJUST STORED IN MEMORY: ");
-      Serial.println("isAttachedToUSB:   " + String(agrumino.boolRead(attUSBADD)));
-      Serial.println("isBatteryCharging: " + String(agrumino.boolRead(chargADD)));
-      Serial.println("isButtonPressed: "+String(agrumino.boolRead(buttonADD)));
-      Serial.println("temperature:       " + String(agrumino.floatRead(tempADD)));
-      Serial.println("soilMoisture:      " + String(agrumino.floatRead(soilADD)));
-      Serial.println("illuminance :      " + String(agrumino.floatRead(illADD)));
-      Serial.println("batteryVoltage :   " + String(agrumino.floatRead(voltADD)));
-      Serial.println("batteryLevel: "+String(agrumino.intRead(battLVLADD)));
-      Serial.println("");
+      }
+      if(!stored)
+        agrumino.appendRecord(sample); //the sample that didn't fit in the full memory
   }
 
   agrumino.turnBoardOff(); // Board off before delay/sleep to save battery :)
@@ -242,6 +170,28 @@ void loop() {
 /////////////////////
 // Utility methods //
 /////////////////////
+void printSample(const AgruminoSample &sample) {
+  Serial.println("isAttachedToUSB:   " + String(sample.isAttachedToUSB));
+  Serial.println("isBatteryCharging: " + String(sample.isBatteryCharging));
+  Serial.println("isButtonPressed:   " + String(sample.isButtonPressed));
+  Serial.println("temperature:       " + String(sample.temperature));
+  Serial.println("soilMoisture:      " + String(sample.soilMoisture));
+  Serial.println("illuminance :      " + String(sample.illuminance));
+  Serial.println("batteryVoltage :   " + String(sample.batteryVoltage));
+  Serial.println("batteryLevel:      " + String(sample.batteryLevel));
+  Serial.println("time:              " + String(sample.time));
+  Serial.println("");
+}
+
+//the fields of a Thingspeak entry: temperature (m°C), soil moist. %, lux, battery voltage (mV)
+void thingSpeakFields(AgruminoJson &json, const AgruminoSample &sample) {
+  float soilMoisturePerc = (2860-sample.soilMoisture)/14;
+  json.member("field1", sample.temperature*1000, 2);
+  json.member("field2", (int)soilMoisturePerc);
+  json.member("field3", sample.illuminance, 2);
+  json.member("field4", sample.batteryVoltage*1000, 2);
+}
+
 void blinkLed(int duration, int blinks) {
   for (int i = 0; i < blinks; i++) {
     agrumino.turnLedOn();
@@ -258,6 +208,7 @@ void delaySec(int sec) {
   delay (sec * 1000);
 }
 
+//through the library, so the clock of the samples counts the sleep (see AgruminoClock.h)
 void deepSleepSec(int sec) {
-  ESP.deepSleep(sec * 1000000); // microseconds
+  agrumino.deepSleepSec(sec);
 }